@@ -393,8 +393,11 @@ class GlobalSymbolDef {
 	public:
 		std::string symbol;
 		std::unique_ptr<GlobalMemDec> mem_dec;
+		int is_const;
 		GlobalSymbolDef(std::string s, std::unique_ptr<GlobalMemDec> p):
-			symbol(s), mem_dec(std::move(p)) {}
+			symbol(s), mem_dec(std::move(p)), is_const(0) {}
+		GlobalSymbolDef(std::string s, std::unique_ptr<GlobalMemDec> p, int c):
+			symbol(s), mem_dec(std::move(p)), is_const(c) {}
 		std::string Str() const {
 			return "global " + symbol + " = " + mem_dec->Str();
 		}
@@ -3,19 +3,33 @@
 #include <string>
 #include <map>
 #include <set>
+#include <algorithm>
 #include "koopa.hpp"
 #include "types.hpp"
 #include "riscv.hpp"
 #include "koopa2riscv.hpp"
 #include "optim.hpp"
+#include "peephole.hpp"
+#include "schedule.hpp"
 
 using namespace std;
 
-vector<unique_ptr<riscv::Item> > code;
-map<string, VarInfo> global_var_info;
-string reg_name[25];
-int return_counter = 0;
-string cur_return_label;
+// per-compilation state is thread_local so that batch mode can compile
+// several files at once; ParseProgram resets it
+thread_local vector<unique_ptr<riscv::Item> > code;
+thread_local map<string, VarInfo> global_var_info;
+riscv::Reg reg_name[25] = {
+	riscv::S0, riscv::S1, riscv::S2, riscv::S3, riscv::S4, riscv::S5,
+	riscv::S6, riscv::S7, riscv::S8, riscv::S9, riscv::S10, riscv::S11,
+	riscv::T2, riscv::T3, riscv::T4, riscv::T5, riscv::T6,
+	riscv::A0, riscv::A1, riscv::A2, riscv::A3, riscv::A4, riscv::A5, riscv::A6, riscv::A7};
+thread_local int return_counter = 0;
+thread_local string cur_return_label;
+// callee-saved register holding sp + far_base_ofst when the frame exceeds
+// the reach of a 12-bit offset from sp
+thread_local riscv::Reg far_base = riscv::NOREG;
+thread_local int far_base_ofst = 0;
+thread_local map<string, int> fun_clobbers;
 
 void GetVarType(koopa::FunDef *ptr, map<string, VarInfo> &var_info) {
 	auto body = ptr->body.get();
@@ -50,6 +64,10 @@ void GetVarType(koopa::FunDef *ptr, map<string, VarInfo> &var_info) {
 					string ptr_symb = ptr_def->get_ptr->symbol;
 					auto new_type = var_info[ptr_symb].type;
 					var_info[name] = VarInfo(name, LOCALDEF, new_type);
+					auto len = ptr_def->get_ptr->val.get();
+					if (var_info[ptr_symb].var_def == GLOBALDEF && len->val_type == koopa::INTVALUE &&
+						static_cast<koopa::IntValue*>(len)->integer == 0)
+						var_info[name].remat = var_info[ptr_symb].name;
 				} else if (symb_def->def_type == koopa::GETELEMPTRDEF) {
 					auto ptr_def = static_cast<koopa::GetElemPtrDef*>(symb_def);
 					string ptr_symb = ptr_def->get_elem_ptr->symbol;
@@ -68,12 +86,123 @@ void GetVarType(koopa::FunDef *ptr, map<string, VarInfo> &var_info) {
 			}
 }
 
+int GetSlotSize(const VarInfo &info) {
+	if (info.reg >= 0 || !info.remat.empty())
+		return 0;
+	if (info.var_def == LOCALDEF)
+		return 4;
+	if (info.var_def == ALLOCDEF) {
+		assert(info.type->my_type == koopa::POINTERTYPE);
+		auto ptr_type = static_cast<koopa::PointerType*>(info.type.get());
+		return ptr_type->ptr->Size();
+	}
+	return 0;
+}
+
+void GetArrayWebs(koopa::FunBody *ptr, map<string, VarInfo> &var_info,
+map<string, string> &web) {
+	for (auto &pr: var_info)
+		if (pr.second.var_def == ALLOCDEF && pr.second.reg < 0) {
+			auto ptr_type = static_cast<koopa::PointerType*>(pr.second.type.get());
+			if (ptr_type->ptr->my_type == koopa::ARRAYTYPE)
+				web[pr.first] = pr.first;
+		}
+	int upd = 1;
+	while (upd) {
+		upd = 0;
+		for (auto &block: ptr->blocks)
+			for (auto &stmt: block->stmts) {
+				if (stmt->stmt_type != koopa::SYMBOLDEFSTMT)
+					continue;
+				auto symb_def = static_cast<koopa::SymbolDef*>(stmt.get());
+				string base;
+				if (symb_def->def_type == koopa::GETPTRDEF)
+					base = static_cast<koopa::GetPtrDef*>(symb_def)->get_ptr->symbol;
+				else if (symb_def->def_type == koopa::GETELEMPTRDEF)
+					base = static_cast<koopa::GetElemPtrDef*>(symb_def)->get_elem_ptr->symbol;
+				if (web.count(base) && !web.count(symb_def->symbol)) {
+					web[symb_def->symbol] = web[base];
+					upd = 1;
+				}
+			}
+	}
+}
+
+int ColorStackSlots(koopa::FunBody *ptr, map<string, VarInfo> &var_info, int base) {
+	map<string, string> web;
+	GetArrayWebs(ptr, var_info, web);
+	map<string, set<string> > conflicts;
+	map<string, int> weight;
+	for (auto &block: ptr->blocks) {
+		vector<koopa::Statement*> block_stmts;
+		for (auto &stmt: block->stmts)
+			block_stmts.push_back(stmt.get());
+		block_stmts.push_back(block->end_stmt.get());
+		for (koopa::Statement *stmt: block_stmts) {
+			set<string> vars;
+			GetStmtUses(stmt, vars);
+			for (string var: vars)
+				weight[var] += GetBlockWeight(block.get());
+			GetLiveOut(stmt, vars);
+			vars.insert(stmt->live_vars.begin(), stmt->live_vars.end());
+			if (stmt->stmt_type == koopa::SYMBOLDEFSTMT) {
+				string def = static_cast<koopa::SymbolDef*>(stmt)->symbol;
+				vars.insert(def);
+				weight[def] += GetBlockWeight(block.get());
+			} else if (stmt->stmt_type == koopa::STORESTMT)
+				vars.insert(static_cast<koopa::Store*>(stmt)->symbol);
+			set<string> objs;
+			for (string var: vars) {
+				if (web.count(var))
+					objs.insert(web[var]);
+				else if (GetSlotSize(var_info[var]) > 0)
+					objs.insert(var);
+			}
+			for (string obj1: objs)
+				for (string obj2: objs)
+					if (obj1 != obj2)
+						conflicts[obj1].insert(obj2);
+		}
+	}
+	// small and frequently used slots first, so that they stay within the
+	// 12-bit reach of sp
+	vector<pair<pair<int, int>, string> > slots;
+	for (auto &pr: var_info) {
+		int size = GetSlotSize(pr.second);
+		if (size > 0)
+			slots.push_back(make_pair(make_pair(size, -weight[pr.first]), pr.first));
+	}
+	sort(slots.begin(), slots.end());
+	int ofst = base;
+	for (auto &pr: slots) {
+		int size = pr.first.first;
+		VarInfo &info = var_info[pr.second];
+		vector<pair<int, int> > used;
+		for (string obj: conflicts[pr.second]) {
+			const VarInfo &other = var_info[obj];
+			if (other.offset >= 0)
+				used.push_back(make_pair(other.offset, other.offset + GetSlotSize(other)));
+		}
+		sort(used.begin(), used.end());
+		int start = base;
+		for (auto &range: used)
+			if (range.second > start) {
+				if (range.first >= start + size)
+					break;
+				start = range.second;
+			}
+		info.offset = start;
+		ofst = max(ofst, start + size);
+	}
+	return ofst;
+}
+
 int GetFunOffset(koopa::FunDef *ptr,
 map<string, VarInfo> &var_info,
-int reg_used[], int reg_offset[], int &has_call) {
+int reg_used[], int reg_offset[], int &ra_offset) {
 	int ofst = 0;
 	int max_params = 8;
-	has_call = 0;
+	int has_call = 0;
 	for (auto &block: ptr->body->blocks)
 		for (auto &stmt: block->stmts) {
 			if (stmt->stmt_type == koopa::FUNCALLSTMT) {
@@ -90,30 +219,18 @@ int reg_used[], int reg_offset[], int &has_call) {
 			}
 		}
 	ofst += (max_params - 8) * 4;
+	ra_offset = -1;
+	if (has_call) {
+		ra_offset = ofst;
+		ofst += 4;
+	}
 	for (int i = 0; i < 25; i++)
 		if (reg_used[i])
 		{
 			reg_offset[i] = ofst;
 			ofst += 4;
 		}
-	for (auto &pr: var_info) {
-		string name = pr.first;
-		VarInfo &info = pr.second;
-		if (info.var_def == LOCALDEF) {
-			if (info.reg < 0) {
-				info.offset = ofst;
-				ofst += 4;
-			}
-		} else if (info.var_def == ALLOCDEF) {
-			if (info.reg < 0) {
-				assert(info.type->my_type == koopa::POINTERTYPE);
-				auto ptr_type = static_cast<koopa::PointerType*>(info.type.get());
-				info.offset = ofst;
-				ofst += ptr_type->ptr->Size();
-			}
-		}
-	}
-	ofst += has_call * 4;
+	ofst = ColorStackSlots(ptr->body.get(), var_info, ofst);
 	if (ofst % 16 != 0)
 		ofst += 16 - ofst % 16;
 	auto &params = ptr->params->params;
@@ -125,42 +242,113 @@ int reg_used[], int reg_offset[], int &has_call) {
 	return ofst;
 }
 
-void LoadOffset(string reg, int ofst) {
-	if (ofst < 2048)
-		code.push_back(make_unique<riscv::ImmInstr>("lw", reg, "sp", ofst));
+// splits sp + ofst into a base register and a 12-bit displacement; returns 0
+// when neither sp nor the far base reaches it
+int GetSlotAddr(int ofst, riscv::Reg &base, int &disp) {
+	if (ofst < 2048) {
+		base = riscv::SP;
+		disp = ofst;
+		return 1;
+	}
+	if (far_base != riscv::NOREG && ofst - far_base_ofst >= -2048 && ofst - far_base_ofst < 2048) {
+		base = far_base;
+		disp = ofst - far_base_ofst;
+		return 1;
+	}
+	return 0;
+}
+
+// lowest slot offset beyond the reach of sp, or -1 if the frame fits
+int GetFarOffset(map<string, VarInfo> &var_info) {
+	int far_ofst = -1;
+	for (auto &pr: var_info) {
+		const VarInfo &info = pr.second;
+		int size = info.var_def == PARAMDEF ? 4 : GetSlotSize(info);
+		if (size > 0 && info.offset >= 2048 && (far_ofst < 0 || info.offset < far_ofst))
+			far_ofst = info.offset;
+	}
+	return far_ofst;
+}
+
+void LoadOffset(riscv::Reg reg, int ofst) {
+	riscv::Reg base;
+	int disp;
+	if (GetSlotAddr(ofst, base, disp))
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::LW, reg, base, disp));
+	else {
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::LI, reg, riscv::NOREG, ofst));
+		code.push_back(make_unique<riscv::RegInstr>(riscv::ADD, reg, reg, riscv::SP));
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::LW, reg, reg, 0));
+	}
+}
+
+void StoreOffset(riscv::Reg reg, int ofst) {
+	riscv::Reg base;
+	int disp;
+	if (GetSlotAddr(ofst, base, disp))
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::SW, reg, base, disp));
 	else {
-		code.push_back(make_unique<riscv::ImmInstr>("li", reg, "", ofst));
-		code.push_back(make_unique<riscv::RegInstr>("add", reg, reg, "sp"));
-		code.push_back(make_unique<riscv::ImmInstr>("lw", reg, reg, 0));
+		riscv::Reg tmp = reg == riscv::T0 ? riscv::T1 : riscv::T0;
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::LI, tmp, riscv::NOREG, ofst));
+		code.push_back(make_unique<riscv::RegInstr>(riscv::ADD, tmp, tmp, riscv::SP));
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::SW, reg, tmp, 0));
 	}
 }
 
-void StoreOffset(string reg, int ofst) {
-	if (ofst < 2048)
-		code.push_back(make_unique<riscv::ImmInstr>("sw", reg, "sp", ofst));
+thread_local int zero_fill_counter = 0;
+
+// clears size bytes at sp+ofst: short arrays are unrolled, longer ones use a
+// loop that clears 4 words per iteration
+void ZeroFill(int ofst, int size) {
+	int words = size / 4;
+	riscv::Reg base;
+	int disp;
+	int reached = GetSlotAddr(ofst, base, disp);
+	if (words <= 16 && reached && disp + size <= 2048) {
+		for (int i = 0; i < words; i++)
+			code.push_back(make_unique<riscv::ImmInstr>(riscv::SW, riscv::ZERO, base, disp + i * 4));
+		return;
+	}
+	if (reached)
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::ADDI, riscv::T0, base, disp));
 	else {
-		string tmp = reg == "t0" ? "t1" : "t0";
-		code.push_back(make_unique<riscv::ImmInstr>("li", tmp, "", ofst));
-		code.push_back(make_unique<riscv::RegInstr>("add", tmp, tmp, "sp"));
-		code.push_back(make_unique<riscv::ImmInstr>("sw", reg, tmp, 0));
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::LI, riscv::T0, riscv::NOREG, ofst));
+		code.push_back(make_unique<riscv::RegInstr>(riscv::ADD, riscv::T0, riscv::T0, riscv::SP));
 	}
+	if (words >= 4) {
+		string loop = ".Lzero_fill_" + to_string(zero_fill_counter++);
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::LI, riscv::T1, riscv::NOREG, words / 4));
+		code.push_back(make_unique<riscv::Label>(loop));
+		for (int i = 0; i < 4; i++)
+			code.push_back(make_unique<riscv::ImmInstr>(riscv::SW, riscv::ZERO, riscv::T0, i * 4));
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::ADDI, riscv::T0, riscv::T0, 16));
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::ADDI, riscv::T1, riscv::T1, -1));
+		code.push_back(make_unique<riscv::LabelInstr>(riscv::BNEZ, riscv::T1, loop));
+	}
+	for (int i = 0; i < words % 4; i++)
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::SW, riscv::ZERO, riscv::T0, i * 4));
 }
 
-string LoadVar(const VarInfo &info, string hint) {
+riscv::Reg LoadVar(const VarInfo &info, riscv::Reg hint) {
 	if (info.reg >= 0)
 		return reg_name[info.reg];
-	else if (info.var_def == LOCALDEF || info.var_def == PARAMDEF) {
+	else if (!info.remat.empty()) {
+		code.push_back(make_unique<riscv::LabelInstr>(riscv::LA, hint, info.remat));
+		return hint;
+	} else if (info.var_def == LOCALDEF || info.var_def == PARAMDEF) {
 		LoadOffset(hint, info.offset);
 		return hint;
 	} else if (info.var_def == ALLOCDEF) {
 		assert(info.type->my_type == koopa::POINTERTYPE);
 		auto ptr_type = static_cast<koopa::PointerType*>(info.type.get());
 		if (ptr_type->ptr->my_type == koopa::ARRAYTYPE) {
-			if (info.offset < 2048)
-				code.push_back(make_unique<riscv::ImmInstr>("addi", hint, "sp", info.offset));
+			riscv::Reg base;
+			int disp;
+			if (GetSlotAddr(info.offset, base, disp))
+				code.push_back(make_unique<riscv::ImmInstr>(riscv::ADDI, hint, base, disp));
 			else {
-				code.push_back(make_unique<riscv::ImmInstr>("li", hint, "", info.offset));
-				code.push_back(make_unique<riscv::RegInstr>("add", hint, hint, "sp"));
+				code.push_back(make_unique<riscv::ImmInstr>(riscv::LI, hint, riscv::NOREG, info.offset));
+				code.push_back(make_unique<riscv::RegInstr>(riscv::ADD, hint, hint, riscv::SP));
 			}
 			return hint;
 		} else {
@@ -168,20 +356,20 @@ string LoadVar(const VarInfo &info, string hint) {
 			return hint;
 		}
 	} else if (info.var_def == GLOBALDEF) {
-		string reg = hint;
-		code.push_back(make_unique<riscv::LabelInstr>("la", reg, info.name));
+		riscv::Reg reg = hint;
+		code.push_back(make_unique<riscv::LabelInstr>(riscv::LA, reg, info.name));
 		return reg;
 	} else
 		assert(0);
-	return "";
+	return riscv::NOREG;
 }
 
-string LoadInt(int val, string hint) {
-	code.push_back(make_unique<riscv::ImmInstr>("li", hint, "", val));
+riscv::Reg LoadInt(int val, riscv::Reg hint) {
+	code.push_back(make_unique<riscv::ImmInstr>(riscv::LI, hint, riscv::NOREG, val));
 	return hint;
 }
 
-string LoadKoopaValue(const koopa::Value *val, map<string, VarInfo> &var_info, string hint) {
+riscv::Reg LoadKoopaValue(const koopa::Value *val, map<string, VarInfo> &var_info, riscv::Reg hint) {
 	if (val->val_type == koopa::INTVALUE) {
 		auto int_val = static_cast<const koopa::IntValue*>(val);
 		return LoadInt(int_val->integer, hint);
@@ -190,67 +378,248 @@ string LoadKoopaValue(const koopa::Value *val, map<string, VarInfo> &var_info, s
 		const VarInfo &info = var_info[symb_val->symbol];
 		return LoadVar(info, hint);
 	}
-	return "";
+	return riscv::NOREG;
 }
 
-void StoreVar(const VarInfo &info, string rs) {
+// dest = base + len * size; a constant len folds into a single addi, taken
+// straight from sp when base is a stack array
+void ParsePtrOffset(const VarInfo &base_info, const koopa::Value *len, int size,
+map<string, VarInfo> &var_info, riscv::Reg dest_reg) {
+	if (len->val_type == koopa::INTVALUE) {
+		int delta = static_cast<const koopa::IntValue*>(len)->integer * size;
+		if (delta == 0) {
+			riscv::Reg base_reg = LoadVar(base_info, dest_reg);
+			if (base_reg != dest_reg)
+				code.push_back(make_unique<riscv::RegInstr>(riscv::MV, dest_reg, base_reg, riscv::NOREG));
+			return;
+		}
+		riscv::Reg slot_base;
+		int disp;
+		if (base_info.var_def == ALLOCDEF && base_info.reg < 0 &&
+			GetSlotAddr(base_info.offset + delta, slot_base, disp)) {
+			code.push_back(make_unique<riscv::ImmInstr>(riscv::ADDI, dest_reg, slot_base, disp));
+			return;
+		}
+		riscv::Reg base_reg = LoadVar(base_info, riscv::T1);
+		if (delta >= -2048 && delta < 2048) {
+			code.push_back(make_unique<riscv::ImmInstr>(riscv::ADDI, dest_reg, base_reg, delta));
+			return;
+		}
+		riscv::Reg delta_reg = LoadInt(delta, riscv::T0);
+		code.push_back(make_unique<riscv::RegInstr>(riscv::ADD, dest_reg, base_reg, delta_reg));
+		return;
+	}
+	riscv::Reg len_reg = LoadKoopaValue(len, var_info, riscv::T0);
+	riscv::Reg mul_int = LoadInt(size, riscv::T1);
+	code.push_back(make_unique<riscv::RegInstr>(riscv::MUL, riscv::T0, mul_int, len_reg));
+	riscv::Reg base_reg = LoadVar(base_info, riscv::T1);
+	code.push_back(make_unique<riscv::RegInstr>(riscv::ADD, dest_reg, base_reg, riscv::T0));
+}
+
+void StoreVar(const VarInfo &info, riscv::Reg rs) {
 	if (info.reg >= 0) {
-		string rd = reg_name[info.reg];
+		riscv::Reg rd = reg_name[info.reg];
 		if (rd != rs)
-			code.push_back(make_unique<riscv::RegInstr>("mv", rd, rs, ""));
+			code.push_back(make_unique<riscv::RegInstr>(riscv::MV, rd, rs, riscv::NOREG));
+	} else if (!info.remat.empty()) {
+		// rematerialized at each use
 	} else if (info.var_def == LOCALDEF || info.var_def == ALLOCDEF) {
 		StoreOffset(rs, info.offset);
 	} else if (info.var_def == GLOBALDEF) {
-		string tmp = rs == "t0" ? "t1" : "t0";
-		code.push_back(make_unique<riscv::LabelInstr>("la", tmp, info.name));
-		code.push_back(make_unique<riscv::ImmInstr>("sw", rs, tmp, 0));
+		riscv::Reg tmp = rs == riscv::T0 ? riscv::T1 : riscv::T0;
+		code.push_back(make_unique<riscv::LabelInstr>(riscv::LA, tmp, info.name));
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::SW, rs, tmp, 0));
 	} else
 		assert(0);
 }
 
-void ParseFunCall(koopa::FunCall *ptr,
-map<string, VarInfo> &var_info,
-int reg_used[], int reg_offset[]) {
+void ParallelMove(vector<pair<riscv::Reg, riscv::Reg> > &moves) {
+	while (!moves.empty()) {
+		int done = 0;
+		for (int i = 0; i < moves.size(); i++) {
+			int blocked = 0;
+			for (int j = 0; j < moves.size(); j++)
+				if (j != i && moves[j].second == moves[i].first)
+					blocked = 1;
+			if (!blocked) {
+				code.push_back(make_unique<riscv::RegInstr>(riscv::MV, moves[i].first, moves[i].second, riscv::NOREG));
+				moves.erase(moves.begin() + i);
+				done = 1;
+				break;
+			}
+		}
+		if (!done) {
+			riscv::Reg rs = moves[0].second;
+			code.push_back(make_unique<riscv::RegInstr>(riscv::MV, riscv::T0, rs, riscv::NOREG));
+			for (auto &mv: moves)
+				if (mv.second == rs)
+					mv.second = riscv::T0;
+		}
+	}
+}
+
+void ParseFunCall(koopa::FunCall *ptr, map<string, VarInfo> &var_info) {
 	int num_params = ptr->params.size();
 	for (int i = 8; i < num_params; i++) {
 		auto val = ptr->params[i].get();
-		string rs = LoadKoopaValue(val, var_info, "t0");
+		riscv::Reg rs = LoadKoopaValue(val, var_info, riscv::T0);
 		StoreOffset(rs, (i-8)*4);
 	}
+	vector<pair<riscv::Reg, riscv::Reg> > moves;
+	for (int i = 0; i < 8 && i < num_params; i++) {
+		auto val = ptr->params[i].get();
+		if (val->val_type == koopa::SYMBOLVALUE) {
+			auto symb_val = static_cast<koopa::SymbolValue*>(val);
+			const VarInfo &info = var_info[symb_val->symbol];
+			if (info.reg >= 0 && info.reg != i + 17)
+				moves.push_back(make_pair(reg_name[i + 17], reg_name[info.reg]));
+		}
+	}
+	ParallelMove(moves);
 	for (int i = 0; i < 8 && i < num_params; i++) {
 		auto val = ptr->params[i].get();
-		string ai = "a" + to_string(i);
+		riscv::Reg ai = reg_name[i + 17];
 		if (val->val_type == koopa::INTVALUE) {
 			auto int_val = static_cast<koopa::IntValue*>(val);
-			code.push_back(make_unique<riscv::ImmInstr>("li", ai, "", int_val->integer));
+			code.push_back(make_unique<riscv::ImmInstr>(riscv::LI, ai, riscv::NOREG, int_val->integer));
 		} else {
 			auto symb_val = static_cast<koopa::SymbolValue*>(val);
 			const VarInfo &info = var_info[symb_val->symbol];
-			if (info.reg >= 0) {
-				if (info.reg <= 16)
-					code.push_back(make_unique<riscv::RegInstr>("mv", ai, reg_name[info.reg], ""));
-				else
-					LoadOffset(ai, reg_offset[info.reg]);
-			} else {
-				string reg = LoadVar(info, ai);
+			if (info.reg < 0) {
+				riscv::Reg reg = LoadVar(info, ai);
 				assert(reg == ai);
 			}
 		}
 	}
-	code.push_back(make_unique<riscv::LabelInstr>("call", "", ptr->symbol.substr(1)));
+	code.push_back(make_unique<riscv::LabelInstr>(riscv::CALL, riscv::NOREG, ptr->symbol.substr(1)));
+}
+
+void GetCallSaves(koopa::Statement *stmt, koopa::FunCall *fun_call,
+map<string, VarInfo> &var_info, int call_saves[]) {
+	set<string> live_out;
+	GetLiveOut(stmt, live_out);
+	int mask = GetCallClobbers(fun_call);
+	for (string var: live_out) {
+		int reg = var_info[var].reg;
+		if (reg >= callee_regs && (mask >> reg & 1))
+			call_saves[reg] = 1;
+	}
+}
+
+int GetFunClobbers(koopa::FunBody *ptr, int reg_used[]) {
+	int mask = 1 << 17;
+	for (int i = callee_regs; i < max_regs; i++)
+		if (reg_used[i])
+			mask |= 1 << i;
+	for (auto &block: ptr->blocks)
+		for (auto &stmt: block->stmts) {
+			if (stmt->stmt_type == koopa::FUNCALLSTMT)
+				mask |= GetCallClobbers(static_cast<koopa::FunCall*>(stmt.get()));
+			else if (stmt->stmt_type == koopa::SYMBOLDEFSTMT) {
+				auto symb_def = static_cast<koopa::SymbolDef*>(stmt.get());
+				if (symb_def->def_type == koopa::FUNCALLDEF)
+					mask |= GetCallClobbers(static_cast<koopa::FunCallDef*>(symb_def)->fun_call.get());
+			}
+		}
+	return mask;
+}
+
+int PreRegionNeedsFrame(koopa::FunBody *ptr, const set<koopa::Block*> &frame_blocks,
+map<string, VarInfo> &var_info) {
+	for (auto &block: ptr->blocks) {
+		if (frame_blocks.count(block.get()))
+			continue;
+		vector<koopa::Statement*> block_stmts;
+		for (auto &stmt: block->stmts)
+			block_stmts.push_back(stmt.get());
+		block_stmts.push_back(block->end_stmt.get());
+		for (koopa::Statement *stmt: block_stmts) {
+			set<string> vars;
+			GetStmtUses(stmt, vars);
+			if (stmt->stmt_type == koopa::SYMBOLDEFSTMT) {
+				auto symb_def = static_cast<koopa::SymbolDef*>(stmt);
+				if (symb_def->def_type != koopa::MEMORYDEF)
+					vars.insert(symb_def->symbol);
+			}
+			for (string var: vars) {
+				const VarInfo &info = var_info[var];
+				if (info.var_def != GLOBALDEF && info.reg < callee_regs &&
+					(info.reg >= 0 || info.remat.empty()))
+					return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+void ParsePrologue(int ofst, int ra_offset, int reg_used[], int reg_offset[]) {
+	if (ofst > 0) {
+		if (ofst <= 2048)
+			code.push_back(make_unique<riscv::ImmInstr>(riscv::ADDI, riscv::SP, riscv::SP, -ofst));
+		else {
+			code.push_back(make_unique<riscv::ImmInstr>(riscv::LI, riscv::T0, riscv::NOREG, ofst));
+			code.push_back(make_unique<riscv::RegInstr>(riscv::SUB, riscv::SP, riscv::SP, riscv::T0));
+		}
+	}
+	if (ra_offset >= 0)
+		StoreOffset(riscv::RA, ra_offset);
+	for (int i = 0; i < callee_regs; i++)
+		if (reg_used[i])
+			StoreOffset(reg_name[i], reg_offset[i]);
+	if (far_base != riscv::NOREG) {
+		code.push_back(make_unique<riscv::ImmInstr>(riscv::LI, riscv::T0, riscv::NOREG, far_base_ofst));
+		code.push_back(make_unique<riscv::RegInstr>(riscv::ADD, far_base, riscv::SP, riscv::T0));
+	}
+}
+
+// restores run with sp-relative offsets only, since the far base register
+// is itself among the restored ones
+void ParseEpilogue(int ofst, int ra_offset, int reg_used[], int reg_offset[]) {
+	riscv::Reg saved_base = far_base;
+	far_base = riscv::NOREG;
+	for (int i = 0; i < callee_regs; i++)
+		if (reg_used[i])
+			LoadOffset(reg_name[i], reg_offset[i]);
+	if (ra_offset >= 0)
+		LoadOffset(riscv::RA, ra_offset);
+	if (ofst > 0) {
+		if (ofst < 2048)
+			code.push_back(make_unique<riscv::ImmInstr>(riscv::ADDI, riscv::SP, riscv::SP, ofst));
+		else {
+			code.push_back(make_unique<riscv::ImmInstr>(riscv::LI, riscv::T0, riscv::NOREG, ofst));
+			code.push_back(make_unique<riscv::RegInstr>(riscv::ADD, riscv::SP, riscv::SP, riscv::T0));
+		}
+	}
+	code.push_back(make_unique<riscv::LabelInstr>(riscv::RET, riscv::NOREG, ""));
+	far_base = saved_base;
+}
+
+int GetEpilogueSize(int ofst, int ra_offset, int reg_used[]) {
+	int size = count(reg_used, reg_used + callee_regs, 1) + (ra_offset >= 0) + 1;
+	if (ofst > 0)
+		size += ofst < 2048 ? 1 : 2;
+	return size;
 }
 
 void ParseFunBody(koopa::FunBody *ptr,
 map<string, VarInfo> &var_info,
-int reg_used[], int reg_offset[]) {
-	for (auto &block: ptr->blocks) {
+int reg_used[], int reg_offset[],
+koopa::Block *save_point, const set<koopa::Block*> &frame_blocks,
+int ofst, int ra_offset, int dup_epilogue) {
+	for (int k = 0; k < ptr->blocks.size(); k++) {
+		auto &block = ptr->blocks[k];
+		string next_symbol;
+		if (k + 1 < ptr->blocks.size())
+			next_symbol = ptr->blocks[k + 1]->symbol;
 		code.push_back(make_unique<riscv::Label>(block->symbol.substr(1)));
+		if (block.get() == save_point)
+			ParsePrologue(ofst, ra_offset, reg_used, reg_offset);
 		for (auto &stmt: block->stmts) {
 			if (stmt->stmt_type == koopa::SYMBOLDEFSTMT) {
 				auto symb_def = static_cast<koopa::SymbolDef*>(stmt.get());
 				string symb_dest = symb_def->symbol;
 				const VarInfo &dest_info = var_info[symb_dest];
-				string dest_reg = "t0";
+				riscv::Reg dest_reg = riscv::T0;
 				if (dest_info.reg >= 0)
 					dest_reg = reg_name[dest_info.reg];
 				if (symb_def->def_type == koopa::MEMORYDEF) {
@@ -259,14 +628,16 @@ int reg_used[], int reg_offset[]) {
 					string load_from = load_def->load->symbol;
 					const VarInfo &load_info = var_info[load_from];
 					if (load_info.var_def == ALLOCDEF) {
-						string reg = LoadVar(load_info, dest_reg);
+						riscv::Reg reg = LoadVar(load_info, dest_reg);
 						StoreVar(dest_info, reg);
 					} else {
-						string reg = LoadVar(load_info, "t0");
-						code.push_back(make_unique<riscv::ImmInstr>("lw", dest_reg, reg, 0));
+						riscv::Reg reg = LoadVar(load_info, riscv::T0);
+						code.push_back(make_unique<riscv::ImmInstr>(riscv::LW, dest_reg, reg, 0));
 						StoreVar(dest_info, dest_reg);
 					}
 				} else if (symb_def->def_type == koopa::GETPTRDEF) {
+					if (!dest_info.remat.empty() && dest_info.reg < 0)
+						continue;
 					auto ptr_def = static_cast<koopa::GetPtrDef*>(symb_def);
 					string base = ptr_def->get_ptr->symbol;
 					auto len = ptr_def->get_ptr->val.get();
@@ -275,11 +646,7 @@ int reg_used[], int reg_offset[]) {
 					assert(base_type->my_type == koopa::POINTERTYPE);
 					auto ptr_type = static_cast<koopa::PointerType*>(base_type);
 					int size = ptr_type->ptr->Size();
-					string len_reg = LoadKoopaValue(len, var_info, "t0");
-					string mul_int = LoadInt(size, "t1");
-					code.push_back(make_unique<riscv::RegInstr>("mul", len_reg, mul_int, len_reg));
-					string base_reg = LoadVar(base_info, "t1");
-					code.push_back(make_unique<riscv::RegInstr>("add", dest_reg, base_reg, len_reg));
+					ParsePtrOffset(base_info, len, size, var_info, dest_reg);
 					StoreVar(dest_info, dest_reg);
 				} else if (symb_def->def_type == koopa::GETELEMPTRDEF) {
 					auto elem_def = static_cast<koopa::GetElemPtrDef*>(symb_def);
@@ -293,117 +660,143 @@ int reg_used[], int reg_offset[]) {
 					assert(arr_type->my_type == koopa::ARRAYTYPE);
 					auto new_type = static_cast<koopa::ArrayType*>(arr_type);
 					int size = new_type->arr->Size();
-					string len_reg = LoadKoopaValue(len, var_info, "t0");
-					string mul_int = LoadInt(size, "t1");
-					code.push_back(make_unique<riscv::RegInstr>("mul", len_reg, mul_int, len_reg));
-					string base_reg = LoadVar(base_info, "t1");
-					code.push_back(make_unique<riscv::RegInstr>("add", dest_reg, base_reg, len_reg));
+					ParsePtrOffset(base_info, len, size, var_info, dest_reg);
 					StoreVar(dest_info, dest_reg);
 				} else if (symb_def->def_type == koopa::BINEXPRDEF) {
 					auto bin_def = static_cast<koopa::BinExprDef*>(symb_def);
 					string op = bin_def->bin_expr->op;
-					string reg1 = LoadKoopaValue(bin_def->bin_expr->val1.get(), var_info, "t0");
-					string reg2 = LoadKoopaValue(bin_def->bin_expr->val2.get(), var_info, "t1");
+					riscv::Reg reg1 = LoadKoopaValue(bin_def->bin_expr->val1.get(), var_info, riscv::T0);
+					riscv::Reg reg2 = LoadKoopaValue(bin_def->bin_expr->val2.get(), var_info, riscv::T1);
 					if (op == "ne") {
-						code.push_back(make_unique<riscv::RegInstr>("xor", dest_reg, reg1, reg2));
-						code.push_back(make_unique<riscv::RegInstr>("snez", dest_reg, dest_reg, ""));
+						code.push_back(make_unique<riscv::RegInstr>(riscv::XOR, dest_reg, reg1, reg2));
+						code.push_back(make_unique<riscv::RegInstr>(riscv::SNEZ, dest_reg, dest_reg, riscv::NOREG));
 					} else if (op == "eq") {
-						code.push_back(make_unique<riscv::RegInstr>("xor", dest_reg, reg1, reg2));
-						code.push_back(make_unique<riscv::RegInstr>("seqz", dest_reg, dest_reg, ""));
+						code.push_back(make_unique<riscv::RegInstr>(riscv::XOR, dest_reg, reg1, reg2));
+						code.push_back(make_unique<riscv::RegInstr>(riscv::SEQZ, dest_reg, dest_reg, riscv::NOREG));
 					} else if (op == "le") {
-						code.push_back(make_unique<riscv::RegInstr>("sgt", dest_reg, reg1, reg2));
-						code.push_back(make_unique<riscv::RegInstr>("seqz", dest_reg, dest_reg, ""));
+						code.push_back(make_unique<riscv::RegInstr>(riscv::SGT, dest_reg, reg1, reg2));
+						code.push_back(make_unique<riscv::RegInstr>(riscv::SEQZ, dest_reg, dest_reg, riscv::NOREG));
 					} else if (op == "ge") {
-						code.push_back(make_unique<riscv::RegInstr>("slt", dest_reg, reg1, reg2));
-						code.push_back(make_unique<riscv::RegInstr>("seqz", dest_reg, dest_reg, ""));
+						code.push_back(make_unique<riscv::RegInstr>(riscv::SLT, dest_reg, reg1, reg2));
+						code.push_back(make_unique<riscv::RegInstr>(riscv::SEQZ, dest_reg, dest_reg, riscv::NOREG));
 					} else {
-						map<string, string> op_map = {
-							{"lt", "slt"}, {"gt", "sgt"}, {"add", "add"}, {"sub", "sub"},
-							{"mul", "mul"}, {"div", "div"}, {"mod", "rem"}, {"and", "and"},
-							{"or", "or"}, {"xor", "xor"}, {"shl", "sll"}, {"shr", "srl"},
-							{"sar", "sra"}};
+						map<string, riscv::OpCode> op_map = {
+							{"lt", riscv::SLT}, {"gt", riscv::SGT}, {"add", riscv::ADD}, {"sub", riscv::SUB},
+							{"mul", riscv::MUL}, {"div", riscv::DIV}, {"mod", riscv::REM}, {"and", riscv::AND},
+							{"or", riscv::OR}, {"xor", riscv::XOR}, {"shl", riscv::SLL}, {"shr", riscv::SRL},
+							{"sar", riscv::SRA}};
 						code.push_back(make_unique<riscv::RegInstr>(op_map[op], dest_reg, reg1, reg2));
 					}
 					StoreVar(dest_info, dest_reg);
 				} else if (symb_def->def_type == koopa::FUNCALLDEF) {
 					auto func_def = static_cast<koopa::FunCallDef*>(symb_def);
 					auto fun_call = func_def->fun_call.get();
-					for (int i = 12; i < 25; i++)
-						if (reg_used[i])
+					int call_saves[25] = {};
+					GetCallSaves(stmt.get(), fun_call, var_info, call_saves);
+					for (int i = callee_regs; i < 25; i++)
+						if (call_saves[i])
 							StoreOffset(reg_name[i], reg_offset[i]);
-					ParseFunCall(fun_call, var_info, reg_used, reg_offset);
-					for (int i = 12; i < 25; i++)
-						if (i != 17 && reg_used[i])
+					ParseFunCall(fun_call, var_info);
+					for (int i = callee_regs; i < 25; i++)
+						if (i != 17 && call_saves[i])
 							LoadOffset(reg_name[i], reg_offset[i]);
-					if (dest_reg != "a0") {
-						StoreVar(dest_info, "a0");
-						if (reg_used[17])
-							LoadOffset("a0", reg_offset[17]);
+					if (dest_reg != riscv::A0) {
+						StoreVar(dest_info, riscv::A0);
+						if (call_saves[17])
+							LoadOffset(riscv::A0, reg_offset[17]);
 					}
 				}
 			} else if (stmt->stmt_type == koopa::STORESTMT) {
 				auto store = static_cast<koopa::Store*>(stmt.get());
-				assert(store->store_type == koopa::VALUESTORE);
+				if (store->store_type == koopa::INITSTORE) {
+					auto init_store = static_cast<koopa::InitStore*>(store);
+					assert(init_store->init->init_type == koopa::ZEROINIT);
+					const VarInfo &dest_info = var_info[store->symbol];
+					assert(dest_info.var_def == ALLOCDEF && dest_info.reg < 0);
+					ZeroFill(dest_info.offset, GetSlotSize(dest_info));
+					continue;
+				}
 				auto val_store = static_cast<koopa::ValueStore*>(store);
 				string symb_dest = val_store->symbol;
 				const VarInfo &dest_info = var_info[symb_dest];
 				if (dest_info.var_def == ALLOCDEF) {
-					string dest_reg = "t0";
+					riscv::Reg dest_reg = riscv::T0;
 					if (dest_info.reg >= 0)
 						dest_reg = reg_name[dest_info.reg];
-					string src_reg = LoadKoopaValue(val_store->val.get(), var_info, dest_reg);
+					riscv::Reg src_reg = LoadKoopaValue(val_store->val.get(), var_info, dest_reg);
 					StoreVar(dest_info, src_reg);
 				} else {
-					string src_reg = LoadKoopaValue(val_store->val.get(), var_info, "t0");
-					string addr_reg = LoadVar(dest_info, "t1");
-					code.push_back(make_unique<riscv::ImmInstr>("sw", src_reg, addr_reg, 0));
+					riscv::Reg src_reg = LoadKoopaValue(val_store->val.get(), var_info, riscv::T0);
+					riscv::Reg addr_reg = LoadVar(dest_info, riscv::T1);
+					code.push_back(make_unique<riscv::ImmInstr>(riscv::SW, src_reg, addr_reg, 0));
 				}
 			} else if (stmt->stmt_type == koopa::FUNCALLSTMT) {
 				auto fun_call = static_cast<koopa::FunCall*>(stmt.get());
-				for (int i = 12; i < 25; i++)
-					if (reg_used[i])
+				int call_saves[25] = {};
+				GetCallSaves(stmt.get(), fun_call, var_info, call_saves);
+				for (int i = callee_regs; i < 25; i++)
+					if (call_saves[i])
 						StoreOffset(reg_name[i], reg_offset[i]);
-				ParseFunCall(fun_call, var_info, reg_used, reg_offset);
-				for (int i = 12; i < 25; i++)
-					if (reg_used[i])
+				ParseFunCall(fun_call, var_info);
+				for (int i = callee_regs; i < 25; i++)
+					if (call_saves[i])
 						LoadOffset(reg_name[i], reg_offset[i]);
 			}
 		}
 		auto end_stmt = block->end_stmt.get();
 		if (end_stmt->stmt_type == koopa::BRANCHEND) {
 			auto branch = static_cast<koopa::Branch*>(end_stmt);
-			string val_reg = LoadKoopaValue(branch->val.get(), var_info, "t0");
-			code.push_back(make_unique<riscv::LabelInstr>("bnez", val_reg, branch->symbol1.substr(1)));
-			code.push_back(make_unique<riscv::LabelInstr>("j", "", branch->symbol2.substr(1)));
+			riscv::Reg val_reg = LoadKoopaValue(branch->val.get(), var_info, riscv::T0);
+			if (branch->symbol1 == next_symbol)
+				code.push_back(make_unique<riscv::LabelInstr>(riscv::BEQZ, val_reg, branch->symbol2.substr(1)));
+			else {
+				code.push_back(make_unique<riscv::LabelInstr>(riscv::BNEZ, val_reg, branch->symbol1.substr(1)));
+				if (branch->symbol2 != next_symbol)
+					code.push_back(make_unique<riscv::LabelInstr>(riscv::J, riscv::NOREG, branch->symbol2.substr(1)));
+			}
 		} else if (end_stmt->stmt_type == koopa::JUMPEND) {
 			auto jump = static_cast<koopa::Jump*>(end_stmt);
-			code.push_back(make_unique<riscv::LabelInstr>("j", "", jump->symbol.substr(1)));
+			if (jump->symbol != next_symbol)
+				code.push_back(make_unique<riscv::LabelInstr>(riscv::J, riscv::NOREG, jump->symbol.substr(1)));
 		} else if (end_stmt->stmt_type == koopa::RETURNEND){
 			auto ret = static_cast<koopa::Return*>(end_stmt);
 			if (ret->val) {
-				string val_reg = LoadKoopaValue(ret->val.get(), var_info, "a0");
-				if (val_reg != "a0")
-					code.push_back(make_unique<riscv::RegInstr>("mv", "a0", val_reg, ""));
+				riscv::Reg val_reg = LoadKoopaValue(ret->val.get(), var_info, riscv::A0);
+				if (val_reg != riscv::A0)
+					code.push_back(make_unique<riscv::RegInstr>(riscv::MV, riscv::A0, val_reg, riscv::NOREG));
 			}
-			code.push_back(make_unique<riscv::LabelInstr>("j", "", cur_return_label));
+			if (frame_blocks.count(block.get()) && dup_epilogue)
+				ParseEpilogue(ofst, ra_offset, reg_used, reg_offset);
+			else if (frame_blocks.count(block.get()))
+				code.push_back(make_unique<riscv::LabelInstr>(riscv::J, riscv::NOREG, cur_return_label));
+			else
+				code.push_back(make_unique<riscv::LabelInstr>(riscv::RET, riscv::NOREG, ""));
 		}
 	}
 }
 
 void ParseFunDef(koopa::FunDef *ptr) {
 	string name = ptr->symbol.substr(1);
+	int start = code.size();
 	code.push_back(make_unique<riscv::PseudoOp>("\t.text", ""));
 	code.push_back(make_unique<riscv::PseudoOp>("\t.globl", name));
 	code.push_back(make_unique<riscv::Label>(name));
 	auto body = ptr->body.get();
 	BuildBlockCFG(body);
 	CutDeadBlocks(body);
+	HoistGlobalAddrs(body, ptr->params.get());
 	map<string, int> used_vars;
 	CutDeadVars(body, used_vars);
+	ScheduleStmts(body);
 	BuildStmtCFG(body);
 	GetLiveVars(body);
+	set<koopa::Block*> need_blocks, frame_blocks;
+	GetStackBlocks(body, ptr->params.get(), need_blocks);
+	koopa::Block *save_point = GetSavePoint(body, need_blocks, frame_blocks);
+	set<string> pre_vars;
+	GetPreRegionVars(body, frame_blocks, pre_vars);
 	map<string, int> var_reg;
-	AllocRegs(body, var_reg, used_vars);
+	AllocRegs(body, ptr->params.get(), var_reg, used_vars, pre_vars);
 	map<string, VarInfo> var_info(global_var_info);
 	GetVarType(ptr, var_info);
 	int reg_used[25] = {};
@@ -413,35 +806,44 @@ void ParseFunDef(koopa::FunDef *ptr) {
 			reg_used[pr.second] = 1;
 		var_info[pr.first].reg = pr.second;
 	}
-	int has_call = 0;
-	int ofst = GetFunOffset(ptr, var_info, reg_used, reg_offset, has_call);
-	if (ofst <= 2048)
-		code.push_back(make_unique<riscv::ImmInstr>("addi", "sp", "sp", -ofst));
-	else {
-		code.push_back(make_unique<riscv::ImmInstr>("li", "t0", "", ofst));
-		code.push_back(make_unique<riscv::RegInstr>("sub", "sp", "sp", "t0"));
+	int ra_offset = -1;
+	int ofst = GetFunOffset(ptr, var_info, reg_used, reg_offset, ra_offset);
+	far_base = riscv::NOREG;
+	int far_ofst = GetFarOffset(var_info);
+	int free_reg = find(reg_used, reg_used + callee_regs, 0) - reg_used;
+	if (far_ofst >= 0 && free_reg < callee_regs) {
+		reg_used[free_reg] = 1;
+		for (auto &pr: var_info)
+			if (pr.second.var_def == LOCALDEF || pr.second.var_def == ALLOCDEF)
+				pr.second.offset = -1;
+		ofst = GetFunOffset(ptr, var_info, reg_used, reg_offset, ra_offset);
+		far_base = reg_name[free_reg];
+		far_base_ofst = GetFarOffset(var_info) + 2048;
+	}
+	if (PreRegionNeedsFrame(body, frame_blocks, var_info)) {
+		save_point = body->blocks[0].get();
+		GetReachable(save_point, frame_blocks);
 	}
-	if (has_call)
-		StoreOffset("ra", ofst - 4);
-	for (int i = 0; i < 12; i++)
-		if (reg_used[i])
-			StoreOffset(reg_name[i], reg_offset[i]);
 	cur_return_label = name + "_ret_" + to_string(return_counter++);
-	ParseFunBody(ptr->body.get(), var_info, reg_used, reg_offset);
-	code.push_back(make_unique<riscv::Label>(cur_return_label));
-	for (int i = 0; i < 12; i++)
-		if (reg_used[i])
-			LoadOffset(reg_name[i], reg_offset[i]);
-	if (has_call)
-		LoadOffset("ra", ofst - 4);
-	if (ofst < 2048)
-		code.push_back(make_unique<riscv::ImmInstr>("addi", "sp", "sp", ofst));
-	else {
-		code.push_back(make_unique<riscv::ImmInstr>("li", "t0", "", ofst));
-		code.push_back(make_unique<riscv::RegInstr>("add", "sp", "sp", "t0"));
+	LayoutBlocks(body);
+	// every return in the frame region gets its own copy of the epilogue
+	// unless that grows the function by more than max_epilogue_growth
+	int frame_returns = 0;
+	for (auto &block: body->blocks)
+		if (frame_blocks.count(block.get()) && block->end_stmt->stmt_type == koopa::RETURNEND)
+			frame_returns++;
+	int epilogue_size = GetEpilogueSize(ofst, ra_offset, reg_used);
+	int dup_epilogue = (frame_returns - 1) * epilogue_size <= max_epilogue_growth;
+	ParseFunBody(body, var_info, reg_used, reg_offset, save_point, frame_blocks, ofst, ra_offset, dup_epilogue);
+	far_base = riscv::NOREG;
+	if (frame_returns > 0 && !dup_epilogue) {
+		code.push_back(make_unique<riscv::Label>(cur_return_label));
+		ParseEpilogue(ofst, ra_offset, reg_used, reg_offset);
 	}
-	code.push_back(make_unique<riscv::LabelInstr>("ret", "", ""));
 	code.push_back(make_unique<riscv::PseudoOp>("", ""));
+	Peephole(code, start);
+	ScheduleCode(code, start);
+	fun_clobbers[ptr->symbol] = GetFunClobbers(body, reg_used);
 }
 
 void UnpackAggregate(const koopa::Initializer *ptr, vector<int> &vals) {
@@ -457,62 +859,62 @@ void UnpackAggregate(const koopa::Initializer *ptr, vector<int> &vals) {
 
 void ParseGlobalSymb(const koopa::GlobalSymbolDef *ptr) {
 	string name = ptr->symbol.substr(1);
-	code.push_back(make_unique<riscv::PseudoOp>("\t.data", ""));
-	code.push_back(make_unique<riscv::PseudoOp>("\t.globl", name));
-	code.push_back(make_unique<riscv::Label>(name));
 	auto mem_type = ptr->mem_dec->mem_type;
 	auto mem_init = ptr->mem_dec->mem_init.get();
-	if (mem_init->init_type == koopa::ZEROINIT) {
-		int len = mem_type->Size();
-		code.push_back(make_unique<riscv::PseudoOp>("\t.zero", to_string(len)));
-	} else {
-		vector<int> init_vals;
+	vector<int> init_vals;
+	if (mem_init->init_type == koopa::ZEROINIT)
+		init_vals = vector<int>(mem_type->Size() / 4, 0);
+	else
 		UnpackAggregate(mem_init, init_vals);
-		for (int x: init_vals)
-			code.push_back(make_unique<riscv::PseudoOp>("\t.word", to_string(x)));
+	int all_zero = 1;
+	for (int x: init_vals)
+		if (x)
+			all_zero = 0;
+	// objects of at most 8 bytes go to the small data sections, which the
+	// linker keeps within reach of gp and relaxes la into gp-relative addi
+	int is_small = mem_type->Size() <= 8;
+	if (ptr->is_const)
+		code.push_back(make_unique<riscv::PseudoOp>("\t.section", is_small ? ".srodata,\"a\"" : ".rodata"));
+	else if (all_zero && is_small)
+		code.push_back(make_unique<riscv::PseudoOp>("\t.section", ".sbss,\"aw\",@nobits"));
+	else if (all_zero)
+		code.push_back(make_unique<riscv::PseudoOp>("\t.bss", ""));
+	else if (is_small)
+		code.push_back(make_unique<riscv::PseudoOp>("\t.section", ".sdata,\"aw\""));
+	else
+		code.push_back(make_unique<riscv::PseudoOp>("\t.data", ""));
+	code.push_back(make_unique<riscv::PseudoOp>("\t.globl", name));
+	code.push_back(make_unique<riscv::Label>(name));
+	for (int i = 0; i < init_vals.size(); ) {
+		int j = i;
+		if (init_vals[i] == 0) {
+			while (j < init_vals.size() && init_vals[j] == 0)
+				j++;
+			code.push_back(make_unique<riscv::PseudoOp>("\t.zero", to_string((j - i) * 4)));
+		} else {
+			string words;
+			for (; j < init_vals.size() && j < i + 16 && init_vals[j]; j++)
+				words += (j > i ? ", " : "") + to_string(init_vals[j]);
+			code.push_back(make_unique<riscv::PseudoOp>("\t.word", words));
+		}
+		i = j;
 	}
 	code.push_back(make_unique<riscv::PseudoOp>("", ""));
 	auto ptr_type = make_shared<koopa::PointerType>(mem_type);
 	global_var_info.emplace(make_pair(ptr->symbol, VarInfo(name, GLOBALDEF, ptr_type)));
 }
 
-void CutDeadLoad() {
-	vector<unique_ptr<riscv::Item> > new_code;
-	riscv::Item *prev = nullptr;
-	for (auto &ptr: code) {
-		if (ptr->item_type == riscv::INSTR && prev && prev->item_type == riscv::INSTR) {
-			auto instr1 = static_cast<riscv::Instr*>(prev);
-			auto instr2 = static_cast<riscv::Instr*>(ptr.get());
-			if (instr1->instr_type == riscv::IMMINSTR && instr2->instr_type == riscv::IMMINSTR) {
-				auto imm1 = static_cast<riscv::ImmInstr*>(instr1);
-				auto imm2 = static_cast<riscv::ImmInstr*>(instr2);
-				if (imm1->op == "sw" && imm2->op == "lw" && imm1->imm == imm2->imm && imm1->rs == imm2->rs) {
-					if (imm1->rd != imm2->rd) {
-						new_code.push_back(make_unique<riscv::RegInstr>("mv", imm2->rd, imm1->rd, ""));
-					}
-					prev = ptr.get();
-					continue;
-				}
-			}
-		}
-		prev = ptr.get();
-		new_code.push_back(move(ptr));
-	}
-	code = move(new_code);
-}
-
 string ParseProgram(koopa::Program *ptr) {
-	for (int i = 0; i < 12; i++)
-		reg_name[i] = "s" + to_string(i);
-	for (int i = 12; i < 17; i++)
-		reg_name[i] = "t" + to_string(i-10);
-	for (int i = 17; i < 25; i++)
-		reg_name[i] = "a" + to_string(i-17);
+	code.clear();
+	global_var_info.clear();
+	return_counter = 0;
+	zero_fill_counter = 0;
+	far_base = riscv::NOREG;
+	fun_clobbers.clear();
 	for (const auto &var: ptr->global_vars)
 		ParseGlobalSymb(var.get());
 	for (const auto &func: ptr->funcs)
 		ParseFunDef(func.get());
-	CutDeadLoad();
 	string result;
 	for (const auto &ptr: code)
 		result += ptr->Str();
@@ -3,6 +3,7 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <map>
 #include "koopa.hpp"
 #include "types.hpp"
 
@@ -22,6 +23,7 @@ class VarInfo {
 		std::shared_ptr<koopa::Type> type;
 		int reg;
 		int offset;
+		std::string remat; // global whose address this is, reloaded with la when spilled
 		VarInfo(): reg(-1), offset(-1) {}
 		VarInfo(std::string s, VarDefType v):
 			name(s), var_def(v), reg(-1), offset(-1){}
@@ -34,4 +36,7 @@ class VarInfo {
 };
 
 const int max_regs = 25;
-const int callee_regs = 12;
\ No newline at end of file
+const int callee_regs = 12;
+const int max_epilogue_growth = 32;
+
+extern thread_local std::map<std::string, int> fun_clobbers;
\ No newline at end of file
@@ -1,12 +1,28 @@
 #include <cassert>
 #include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include <iostream>
 #include <fstream>
 #include <memory>
 #include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
 #include "sysy.hpp"
 #include "sysy2koopa.hpp"
 #include "koopa2riscv.hpp"
+#include "peephole.hpp"
+#include "scanner.hpp"
 
 using namespace std;
 
@@ -27,25 +43,71 @@ decl @stoptime()\n\n\
 // 其次, 因为这个文件不是我们自己写的, 而是被 Bison 生成出来的
 // 你的代码编辑器/IDE 很可能找不到这个文件, 然后会给你报错 (虽然编译不会出错)
 // 看起来会很烦人, 于是干脆采用这种看起来 dirty 但实际很有效的手段
-extern FILE *yyin;
+extern void LexBuffer(char *base, size_t size);
 extern int yyparse(unique_ptr<sysy::CompUnit> &ast);
+extern string parse_error;
 
-int main(int argc, const char *argv[]) {
-	// 解析命令行参数. 测试脚本/评测平台要求你的编译器能接收如下参数:
-	// compiler 模式 输入文件 -o 输出文件
-	assert(argc == 5);
-	auto mode = string(argv[1]);
-	auto input = argv[2];
-	auto output = argv[4];
+// map the source into memory with two trailing zero bytes for the lexer
+// mmap zero-fills the tail of the last page, so the file is only read
+// into a buffer when it ends too close to a page boundary
+char *LoadInput(const char *input, size_t &size, int &mapped) {
+	int fd = open(input, O_RDONLY);
+	assert(fd >= 0);
+	struct stat st;
+	int ret = fstat(fd, &st);
+	assert(!ret);
+	size_t len = st.st_size;
+	size_t page = sysconf(_SC_PAGESIZE);
+	char *base = nullptr;
+	size = len + 2;
+	mapped = 0;
+	if (len > 0 && (len + page - 1) / page * page >= size) {
+		void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			base = static_cast<char*>(p);
+			mapped = 1;
+		}
+	}
+	if (!base) {
+		base = new char[size];
+		size_t done = 0;
+		while (done < len) {
+			ssize_t n = read(fd, base + done, len - done);
+			assert(n > 0);
+			done += n;
+		}
+		base[len] = base[len + 1] = 0;
+	}
+	close(fd);
+	return base;
+}
 
-	// 打开输入文件, 并且指定 lexer 在解析的时候读取这个文件
-	yyin = fopen(input, "r");
-	assert(yyin);
+void FreeInput(char *base, size_t size, int mapped) {
+	if (mapped)
+		munmap(base, size);
+	else
+		delete[] base;
+}
+
+// flex and bison keep their state in globals, so only one thread parses
+// at a time; everything after parsing runs in parallel
+mutex parse_mutex;
 
+// compiles the source in buf, which ends with two 0 bytes; returns 0 and
+// leaves the message in parse_error if it does not parse
+int CompileBuffer(const string &mode, char *buf, size_t size, const string &output, int stats) {
 	// 调用 parser 函数, parser 函数会进一步调用 lexer 解析输入文件的
 	unique_ptr<sysy::CompUnit> ast;
-	auto ret = yyparse(ast);
-	assert(!ret);
+	{
+		lock_guard<mutex> lock(parse_mutex);
+		if (use_hand_scanner)
+			ScanBuffer(buf, size);
+		else
+			LexBuffer(buf, size);
+		parse_error.clear();
+		if (yyparse(ast))
+			return 0;
+	}
 
 	// 输出解析得到的 AST, 其实就是个字符串
 	// cout << *ast << endl;
@@ -63,6 +125,197 @@ int main(int argc, const char *argv[]) {
 	} else if (mode == "-riscv" || mode == "-perf") {
 		string code_riscv = ParseProgram(koopa.get());
 		outfile << code_riscv;
+		if (stats)
+			cerr << PeepholeStats();
+	}
+	return 1;
+}
+
+void CompileFile(const string &mode, const char *input, const string &output, int stats) {
+	// 把输入文件整个映射到内存, lexer 直接在这块缓冲区上扫描
+	size_t input_size;
+	int mapped;
+	char *input_buf = LoadInput(input, input_size, mapped);
+	auto ret = CompileBuffer(mode, input_buf, input_size, output, stats);
+	assert(ret);
+	FreeInput(input_buf, input_size, mapped);
+}
+
+void BatchWorker(const string &mode, const string &out_dir,
+const vector<const char*> &inputs, atomic<int> &next) {
+	string ext = mode == "-koopa" ? ".koopa" : ".S";
+	for (int i = next++; i < inputs.size(); i = next++) {
+		string name = inputs[i];
+		name = name.substr(name.find_last_of('/') + 1);
+		name = name.substr(0, name.find_last_of('.'));
+		CompileFile(mode, inputs[i], out_dir + "/" + name + ext, 0);
+	}
+}
+
+// compiler 模式 -batch 输出目录 [-j N] [-hand-lex] 输入文件...
+// every input a/b.c becomes 输出目录/b.koopa or 输出目录/b.S
+int BatchMain(int argc, const char *argv[]) {
+	assert(argc >= 4);
+	auto mode = string(argv[1]);
+	auto out_dir = string(argv[3]);
+	int jobs = 1;
+	vector<const char*> inputs;
+	for (int i = 4; i < argc; i++) {
+		auto opt = string(argv[i]);
+		if (opt == "-j") {
+			assert(i + 1 < argc);
+			jobs = atoi(argv[++i]);
+			assert(jobs > 0);
+		} else if (opt == "-hand-lex")
+			use_hand_scanner = 1;
+		else
+			inputs.push_back(argv[i]);
+	}
+	atomic<int> next(0);
+	vector<thread> threads;
+	for (int i = 1; i < jobs; i++)
+		threads.emplace_back(BatchWorker, cref(mode), cref(out_dir), cref(inputs), ref(next));
+	BatchWorker(mode, out_dir, inputs, next);
+	for (auto &t: threads)
+		t.join();
+	return 0;
+}
+
+// buffered reads from a pipe or socket
+class FdReader {
+	public:
+		int fd;
+		vector<char> buf;
+		size_t pos, len;
+		FdReader(int fd): fd(fd), buf(65536), pos(0), len(0) {}
+		int Fill() {
+			if (pos < len)
+				return 1;
+			ssize_t n = read(fd, buf.data(), buf.size());
+			if (n <= 0)
+				return 0;
+			pos = 0;
+			len = n;
+			return 1;
+		}
+		int ReadLine(string &line) {
+			line.clear();
+			while (Fill()) {
+				auto p = static_cast<char*>(memchr(buf.data() + pos, '\n', len - pos));
+				size_t end = p ? p - buf.data() : len;
+				line.append(buf.data() + pos, end - pos);
+				pos = p ? end + 1 : end;
+				if (p)
+					return 1;
+			}
+			return 0;
+		}
+		int ReadBytes(char *dest, size_t size) {
+			while (size) {
+				if (!Fill())
+					return 0;
+				size_t n = min(size, len - pos);
+				memcpy(dest, buf.data() + pos, n);
+				pos += n;
+				dest += n;
+				size -= n;
+			}
+			return 1;
+		}
+};
+
+void WriteAll(int fd, const string &s) {
+	size_t done = 0;
+	while (done < s.size()) {
+		ssize_t n = write(fd, s.data() + done, s.size() - done);
+		if (n <= 0)
+			return;
+		done += n;
+	}
+}
+
+// request:  MODE OUTPUT SIZE\n followed by SIZE bytes of source
+// response: ok\n, or error SIZE\n followed by SIZE bytes of diagnostics
+// all compiler state is reset per request by GetCompUnit/ParseProgram,
+// while the identifier pool and the buffers stay allocated
+void Serve(int in_fd, int out_fd) {
+	FdReader reader(in_fd);
+	string line;
+	vector<char> source;
+	while (reader.ReadLine(line)) {
+		if (line.empty())
+			continue;
+		istringstream header(line);
+		string mode, output;
+		size_t size = 0;
+		header >> mode >> output >> size;
+		source.resize(size + 2);
+		if (!reader.ReadBytes(source.data(), size))
+			return;
+		source[size] = source[size + 1] = 0;
+		string error;
+		if (mode != "-koopa" && mode != "-riscv" && mode != "-perf")
+			error = "unknown mode " + mode;
+		else if (!CompileBuffer(mode, source.data(), source.size(), output, 0))
+			error = parse_error;
+		if (error.empty())
+			WriteAll(out_fd, "ok\n");
+		else
+			WriteAll(out_fd, "error " + to_string(error.size()) + "\n" + error);
+	}
+}
+
+// compiler -server [SOCKET]: serve requests on stdin/stdout, or on every
+// connection to the Unix socket SOCKET, one at a time
+int ServerMain(int argc, const char *argv[]) {
+	signal(SIGPIPE, SIG_IGN);
+	if (argc == 2) {
+		Serve(0, 1);
+		return 0;
+	}
+	assert(argc == 3);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	assert(fd >= 0);
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	assert(strlen(argv[2]) < sizeof(addr.sun_path));
+	strcpy(addr.sun_path, argv[2]);
+	unlink(argv[2]);
+	int ret = ::bind(fd, (sockaddr*)&addr, sizeof(addr));
+	assert(!ret);
+	ret = listen(fd, 16);
+	assert(!ret);
+	for (;;) {
+		int conn = accept(fd, nullptr, nullptr);
+		if (conn < 0)
+			continue;
+		Serve(conn, conn);
+		close(conn);
+	}
+	return 0;
+}
+
+int main(int argc, const char *argv[]) {
+	// 解析命令行参数. 测试脚本/评测平台要求你的编译器能接收如下参数:
+	// compiler 模式 输入文件 -o 输出文件 [-stats] [-hand-lex]
+	if (argc >= 2 && string(argv[1]) == "-server")
+		return ServerMain(argc, argv);
+	if (argc >= 3 && string(argv[2]) == "-batch")
+		return BatchMain(argc, argv);
+	assert(argc >= 5);
+	auto mode = string(argv[1]);
+	auto input = argv[2];
+	auto output = argv[4];
+	int stats = 0;
+	for (int i = 5; i < argc; i++) {
+		auto opt = string(argv[i]);
+		if (opt == "-stats")
+			stats = 1;
+		else if (opt == "-hand-lex")
+			use_hand_scanner = 1;
+		else
+			assert(0);
 	}
+	CompileFile(mode, input, output, stats);
 	return 0;
 }
@@ -7,9 +7,11 @@
 #include <cassert>
 #include <random>
 #include <algorithm>
+#include <cmath>
 #include "koopa.hpp"
 #include "optim.hpp"
 #include "koopa2riscv.hpp"
+#include "schedule.hpp"
 
 using namespace std;
 using namespace koopa;
@@ -70,114 +72,105 @@ void CutDeadBlocks(FunBody *ptr) {
 	ptr->blocks = move(new_blocks);
 }
 
-void CountUsedVars(Block *block, map<string, int> &used_vars) {
+int GetBlockWeight(Block *block) {
 	string block_name = block->symbol;
-	int is_while = 1;
 	if (block_name.substr(1,12) == "while_begin_" ||
 		block_name.substr(1,11) == "while_body_")
-			is_while = 10;
-	auto end_stmt = static_cast<Statement*>(block->end_stmt.get());
-	set<string> &end_live_vars = end_stmt->live_vars;
-	end_live_vars.clear();
-	if (end_stmt->stmt_type == RETURNEND) {
-		auto ret_end = static_cast<const Return*>(end_stmt);
-		if (ret_end->val && ret_end->val->val_type == SYMBOLVALUE) {
-			auto symb = static_cast<const SymbolValue*>(ret_end->val.get());
-			used_vars[symb->symbol] += is_while;
-			end_live_vars.insert(symb->symbol);
-		}
-	} else if (end_stmt->stmt_type == BRANCHEND) {
-		auto br_end = static_cast<const Branch*>(end_stmt);
-		if (br_end->val->val_type == SYMBOLVALUE) {
-			auto symb = static_cast<const SymbolValue*>(br_end->val.get());
-			used_vars[symb->symbol] += is_while;
-			end_live_vars.insert(symb->symbol);
-		}
-	}
-	for (const auto &stmt: block->stmts) {
-		set<string> &live_vars = stmt->live_vars;
-		live_vars.clear();
-		if (stmt->stmt_type == SYMBOLDEFSTMT) {
-			auto symb_def = static_cast<const SymbolDef*>(stmt.get());
-			if (symb_def->def_type == LOADDEF) {
-				auto load_def = static_cast<const LoadDef*>(symb_def);
-				used_vars[load_def->load->symbol] += is_while;
-				live_vars.insert(load_def->load->symbol);
-			} else if (symb_def->def_type == GETPTRDEF) {
-				auto ptr_def = static_cast<const GetPtrDef*>(symb_def);
-				used_vars[ptr_def->get_ptr->symbol] += is_while;
-				live_vars.insert(ptr_def->get_ptr->symbol);
-				auto val = ptr_def->get_ptr->val.get();
-				if (val->val_type == SYMBOLVALUE) {
-					auto symb_val = static_cast<const SymbolValue*>(val);
-					used_vars[symb_val->symbol] += is_while;
-					live_vars.insert(symb_val->symbol);
-				}
-			} else if (symb_def->def_type == GETELEMPTRDEF) {
-				auto ptr_def = static_cast<const GetElemPtrDef*>(symb_def);
-				used_vars[ptr_def->get_elem_ptr->symbol] += is_while;
-				live_vars.insert(ptr_def->get_elem_ptr->symbol);
-				auto val = ptr_def->get_elem_ptr->val.get();
-				if (val->val_type == SYMBOLVALUE) {
-					auto symb_val = static_cast<const SymbolValue*>(val);
-					used_vars[symb_val->symbol] += is_while;
-					live_vars.insert(symb_val->symbol);
-				}
-			} else if (symb_def->def_type == BINEXPRDEF) {
-				auto bin_def = static_cast<const BinExprDef*>(symb_def);
-				auto val1 = bin_def->bin_expr->val1.get();
-				auto val2 = bin_def->bin_expr->val2.get();
-				if (val1->val_type == SYMBOLVALUE) {
-					auto symb_val = static_cast<const SymbolValue*>(val1);
-					used_vars[symb_val->symbol] += is_while;
-					live_vars.insert(symb_val->symbol);
-				}
-				if (val2->val_type == SYMBOLVALUE) {
-					auto symb_val = static_cast<const SymbolValue*>(val2);
-					used_vars[symb_val->symbol] += is_while;
-					live_vars.insert(symb_val->symbol);
-				}
-			} else if (symb_def->def_type == FUNCALLDEF) {
-				auto func_def = static_cast<const FunCallDef*>(symb_def);
-				for (const auto &val: func_def->fun_call->params) {
-					if (val->val_type == SYMBOLVALUE) {
-						auto symb_val = static_cast<const SymbolValue*>(val.get());
-						used_vars[symb_val->symbol] += is_while;
-						live_vars.insert(symb_val->symbol);
-					}
-				}
-			}
-		} else if (stmt->stmt_type == STORESTMT) {
-			auto store = static_cast<const Store*>(stmt.get());
-			used_vars[store->symbol] += is_while;
-			live_vars.insert(store->symbol);
-			if (store->store_type == VALUESTORE) {
-				auto val_store = static_cast<const ValueStore*>(store);
-				if (val_store->val->val_type == SYMBOLVALUE) {
-					auto symb_val = static_cast<const SymbolValue*>(val_store->val.get());
-					used_vars[symb_val->symbol] += is_while;
-					live_vars.insert(symb_val->symbol);
-				}
-			}
-		} else if (stmt->stmt_type == FUNCALLSTMT) {
-			auto func = static_cast<const FunCall*>(stmt.get());
-			for (const auto &val: func->params) {
-				if (val->val_type == SYMBOLVALUE) {
-					auto symb_val = static_cast<const SymbolValue*>(val.get());
-					used_vars[symb_val->symbol] += is_while;
-					live_vars.insert(symb_val->symbol);
+			return 10;
+	return 1;
+}
+
+void GetRegAllocs(FunBody *ptr, set<string> &reg_allocs) {
+	reg_allocs.clear();
+	for (auto &block: ptr->blocks)
+		for (auto &stmt: block->stmts)
+			if (stmt->stmt_type == SYMBOLDEFSTMT) {
+				auto symb_def = static_cast<SymbolDef*>(stmt.get());
+				if (symb_def->def_type == MEMORYDEF) {
+					auto mem_def = static_cast<MemoryDef*>(symb_def);
+					if (mem_def->mem_dec->mem_type->my_type != ARRAYTYPE)
+						reg_allocs.insert(symb_def->symbol);
 				}
 			}
+}
+
+void GetStmtUses(Statement *stmt, set<string> &uses) {
+	uses.clear();
+	vector<Value*> vals;
+	if (stmt->stmt_type == RETURNEND) {
+		auto ret_end = static_cast<Return*>(stmt);
+		if (ret_end->val)
+			vals.push_back(ret_end->val.get());
+	} else if (stmt->stmt_type == BRANCHEND) {
+		auto br_end = static_cast<Branch*>(stmt);
+		vals.push_back(br_end->val.get());
+	} else if (stmt->stmt_type == SYMBOLDEFSTMT) {
+		auto symb_def = static_cast<SymbolDef*>(stmt);
+		if (symb_def->def_type == LOADDEF) {
+			auto load_def = static_cast<LoadDef*>(symb_def);
+			uses.insert(load_def->load->symbol);
+		} else if (symb_def->def_type == GETPTRDEF) {
+			auto ptr_def = static_cast<GetPtrDef*>(symb_def);
+			uses.insert(ptr_def->get_ptr->symbol);
+			vals.push_back(ptr_def->get_ptr->val.get());
+		} else if (symb_def->def_type == GETELEMPTRDEF) {
+			auto ptr_def = static_cast<GetElemPtrDef*>(symb_def);
+			uses.insert(ptr_def->get_elem_ptr->symbol);
+			vals.push_back(ptr_def->get_elem_ptr->val.get());
+		} else if (symb_def->def_type == BINEXPRDEF) {
+			auto bin_def = static_cast<BinExprDef*>(symb_def);
+			vals.push_back(bin_def->bin_expr->val1.get());
+			vals.push_back(bin_def->bin_expr->val2.get());
+		} else if (symb_def->def_type == FUNCALLDEF) {
+			auto func_def = static_cast<FunCallDef*>(symb_def);
+			for (auto &val: func_def->fun_call->params)
+				vals.push_back(val.get());
+		}
+	} else if (stmt->stmt_type == STORESTMT) {
+		auto store = static_cast<Store*>(stmt);
+		uses.insert(store->symbol);
+		if (store->store_type == VALUESTORE) {
+			auto val_store = static_cast<ValueStore*>(store);
+			vals.push_back(val_store->val.get());
 		}
+	} else if (stmt->stmt_type == FUNCALLSTMT) {
+		auto func = static_cast<FunCall*>(stmt);
+		for (auto &val: func->params)
+			vals.push_back(val.get());
 	}
+	for (Value *val: vals)
+		if (val->val_type == SYMBOLVALUE)
+			uses.insert(static_cast<SymbolValue*>(val)->symbol);
+}
 
+void CountUsedVars(Block *block, map<string, int> &used_vars,
+const set<string> &reg_allocs) {
+	int is_while = GetBlockWeight(block);
+	vector<Statement*> block_stmts;
+	for (auto &stmt: block->stmts)
+		block_stmts.push_back(stmt.get());
+	block_stmts.push_back(block->end_stmt.get());
+	for (Statement *stmt: block_stmts) {
+		set<string> uses;
+		GetStmtUses(stmt, uses);
+		stmt->live_vars.clear();
+		for (string var: uses) {
+			used_vars[var] += is_while;
+			if (stmt->stmt_type == STORESTMT && reg_allocs.count(var) &&
+				static_cast<Store*>(stmt)->symbol == var)
+				continue;
+			stmt->live_vars.insert(var);
+		}
+	}
 }
 
 void CutDeadVars(FunBody *ptr, map<string, int> &used_vars) {
+	set<string> reg_allocs;
+	GetRegAllocs(ptr, reg_allocs);
 	while(1) {
 		used_vars.clear();
 		for (auto &block: ptr->blocks)
-			CountUsedVars(block.get(), used_vars);
+			CountUsedVars(block.get(), used_vars, reg_allocs);
 		int cut = 0;
 		for (auto &block: ptr->blocks) {
 			vector<unique_ptr<Statement> > new_stmts;
@@ -235,6 +228,8 @@ void BuildStmtCFG(FunBody *ptr) {
 }
 
 void GetLiveVars(FunBody *ptr) {
+	set<string> reg_allocs;
+	GetRegAllocs(ptr, reg_allocs);
 	queue<Statement*> q;
 	for (auto &block: ptr->blocks) {
 		if (!block->end_stmt->live_vars.empty())
@@ -253,6 +248,10 @@ void GetLiveVars(FunBody *ptr) {
 			if (nxt->stmt_type == SYMBOLDEFSTMT) {
 				auto symb_def = static_cast<SymbolDef*>(nxt);
 				del = symb_def->symbol;
+			} else if (nxt->stmt_type == STORESTMT) {
+				auto store = static_cast<Store*>(nxt);
+				if (reg_allocs.count(store->symbol))
+					del = store->symbol;
 			}
 			for (string var: cur->live_vars)
 				if (var != del) {
@@ -267,11 +266,540 @@ void GetLiveVars(FunBody *ptr) {
 	}
 }
 
-void AllocRegs(FunBody *ptr, map<string, int> &var2reg, map<string, int> &used_vars) {
+void GetLiveOut(Statement *stmt, set<string> &live_out) {
+	live_out.clear();
+	for (Statement *nxt: stmt->next_stmts)
+		live_out.insert(nxt->live_vars.begin(), nxt->live_vars.end());
+	if (stmt->stmt_type == SYMBOLDEFSTMT) {
+		auto symb_def = static_cast<SymbolDef*>(stmt);
+		live_out.erase(symb_def->symbol);
+	}
+}
+
+void GetDominators(FunBody *ptr, map<Block*, set<Block*> > &dom) {
+	set<Block*> all_blocks;
+	for (auto &block: ptr->blocks)
+		all_blocks.insert(block.get());
+	Block *entry = ptr->blocks[0].get();
+	for (auto &block: ptr->blocks)
+		dom[block.get()] = all_blocks;
+	dom[entry] = {entry};
+	int upd = 1;
+	while (upd) {
+		upd = 0;
+		for (auto &block: ptr->blocks) {
+			Block *cur = block.get();
+			if (cur == entry)
+				continue;
+			set<Block*> new_dom(all_blocks);
+			for (Block *prev: cur->prev_blocks) {
+				set<Block*> tmp;
+				for (Block *b: new_dom)
+					if (dom[prev].count(b))
+						tmp.insert(b);
+				new_dom = move(tmp);
+			}
+			new_dom.insert(cur);
+			if (new_dom != dom[cur]) {
+				dom[cur] = move(new_dom);
+				upd = 1;
+			}
+		}
+	}
+}
+
+void GetReachable(Block *start, set<Block*> &reached) {
+	reached.clear();
+	vector<Block*> vec;
+	vec.push_back(start);
+	reached.insert(start);
+	while (!vec.empty()) {
+		Block *cur = vec.back();
+		vec.pop_back();
+		for (Block *nxt: cur->next_blocks)
+			if (!reached.count(nxt)) {
+				reached.insert(nxt);
+				vec.push_back(nxt);
+			}
+	}
+}
+
+void GetStackBlocks(FunBody *ptr, FunParams *params, set<Block*> &need_blocks) {
+	set<string> stack_vars;
+	for (int i = 8; i < params->params.size(); i++)
+		stack_vars.insert(params->params[i].first);
+	for (auto &block: ptr->blocks)
+		for (auto &stmt: block->stmts)
+			if (stmt->stmt_type == SYMBOLDEFSTMT) {
+				auto symb_def = static_cast<SymbolDef*>(stmt.get());
+				if (symb_def->def_type == MEMORYDEF) {
+					auto mem_def = static_cast<MemoryDef*>(symb_def);
+					if (mem_def->mem_dec->mem_type->my_type == ARRAYTYPE)
+						stack_vars.insert(symb_def->symbol);
+				}
+			}
+	for (auto &block: ptr->blocks) {
+		vector<Statement*> block_stmts;
+		for (auto &stmt: block->stmts)
+			block_stmts.push_back(stmt.get());
+		block_stmts.push_back(block->end_stmt.get());
+		for (Statement *stmt: block_stmts) {
+			int need = stmt->stmt_type == FUNCALLSTMT;
+			if (stmt->stmt_type == SYMBOLDEFSTMT)
+				need |= static_cast<SymbolDef*>(stmt)->def_type == FUNCALLDEF;
+			set<string> uses;
+			GetStmtUses(stmt, uses);
+			for (string var: uses)
+				need |= stack_vars.count(var);
+			if (need)
+				need_blocks.insert(block.get());
+		}
+	}
+}
+
+Block *GetSavePoint(FunBody *ptr, const set<Block*> &need_blocks, set<Block*> &frame_blocks) {
+	Block *entry = ptr->blocks[0].get();
+	map<Block*, set<Block*> > dom;
+	GetDominators(ptr, dom);
+	vector<pair<int, Block*> > cands;
+	for (auto &block: ptr->blocks) {
+		int dom_all = !need_blocks.empty();
+		for (Block *need: need_blocks)
+			if (!dom[need].count(block.get()))
+				dom_all = 0;
+		if (dom_all)
+			cands.push_back(make_pair(dom[block.get()].size(), block.get()));
+	}
+	sort(cands.rbegin(), cands.rend());
+	for (auto &pr: cands) {
+		Block *cur = pr.second;
+		GetReachable(cur, frame_blocks);
+		int ok = 1;
+		for (Block *b: frame_blocks)
+			if (!dom[b].count(cur))
+				ok = 0;
+		for (Block *prev: cur->prev_blocks)
+			if (frame_blocks.count(prev))
+				ok = 0;
+		if (ok)
+			return cur;
+	}
+	GetReachable(entry, frame_blocks);
+	return entry;
+}
+
+void GetPreRegionVars(FunBody *ptr, const set<Block*> &frame_blocks, set<string> &pre_vars) {
+	for (auto &block: ptr->blocks) {
+		if (frame_blocks.count(block.get()))
+			continue;
+		for (auto &stmt: block->stmts) {
+			pre_vars.insert(stmt->live_vars.begin(), stmt->live_vars.end());
+			if (stmt->stmt_type == SYMBOLDEFSTMT)
+				pre_vars.insert(static_cast<SymbolDef*>(stmt.get())->symbol);
+		}
+		auto &end_live_vars = block->end_stmt->live_vars;
+		pre_vars.insert(end_live_vars.begin(), end_live_vars.end());
+	}
+}
+
+void GetLoopDepth(FunBody *ptr, map<Block*, int> &depth) {
+	map<Block*, set<Block*> > dom;
+	GetDominators(ptr, dom);
+	for (auto &block: ptr->blocks)
+		depth[block.get()] = 0;
+	for (auto &block: ptr->blocks)
+		for (Block *head: block->next_blocks) {
+			if (!dom[block.get()].count(head))
+				continue;
+			set<Block*> body;
+			vector<Block*> vec;
+			body.insert(head);
+			if (!body.count(block.get())) {
+				body.insert(block.get());
+				vec.push_back(block.get());
+			}
+			while (!vec.empty()) {
+				Block *cur = vec.back();
+				vec.pop_back();
+				for (Block *prev: cur->prev_blocks)
+					if (!body.count(prev)) {
+						body.insert(prev);
+						vec.push_back(prev);
+					}
+			}
+			for (Block *b: body)
+				depth[b]++;
+		}
+}
+
+void LayoutBlocks(FunBody *ptr) {
+	map<Block*, int> depth;
+	GetLoopDepth(ptr, depth);
+	map<Block*, int> order;
+	for (int i = 0; i < ptr->blocks.size(); i++)
+		order[ptr->blocks[i].get()] = i;
+	vector<pair<double, pair<int, int> > > edges;
+	for (auto &block: ptr->blocks) {
+		Block *cur = block.get();
+		double freq = pow(10, min(depth[cur], 4));
+		for (Block *nxt: cur->next_blocks) {
+			double prob = 1.0 / cur->next_blocks.size();
+			if (cur->next_blocks.size() == 2) {
+				Block *other = cur->next_blocks[0] == nxt ? cur->next_blocks[1] : cur->next_blocks[0];
+				if (depth[nxt] < depth[cur] && depth[other] >= depth[cur])
+					prob = 0.1;
+				else if (depth[other] < depth[cur] && depth[nxt] >= depth[cur])
+					prob = 0.9;
+			}
+			edges.push_back(make_pair(freq * prob, make_pair(order[cur], order[nxt])));
+		}
+	}
+	stable_sort(edges.begin(), edges.end(),
+		[](const pair<double, pair<int, int> > &a, const pair<double, pair<int, int> > &b) {
+			return a.first > b.first;
+		});
+	int n = ptr->blocks.size();
+	vector<int> chain_of(n), succ(n, -1), pred(n, -1);
+	for (int i = 0; i < n; i++)
+		chain_of[i] = i;
+	for (auto &edge: edges) {
+		int u = edge.second.first, v = edge.second.second;
+		if (u == v || succ[u] != -1 || pred[v] != -1 || v == 0)
+			continue;
+		if (chain_of[u] == chain_of[v])
+			continue;
+		succ[u] = v;
+		pred[v] = u;
+		int old_chain = chain_of[v];
+		for (int i = 0; i < n; i++)
+			if (chain_of[i] == old_chain)
+				chain_of[i] = chain_of[u];
+	}
+	vector<vector<int> > chains;
+	for (int i = 0; i < n; i++)
+		if (pred[i] == -1) {
+			vector<int> chain;
+			for (int j = i; j != -1; j = succ[j])
+				chain.push_back(j);
+			Block *head = ptr->blocks[chain[0]].get();
+			Block *tail = ptr->blocks[chain.back()].get();
+			if (chain.size() > 1 && chain[0] != 0 &&
+				find(tail->next_blocks.begin(), tail->next_blocks.end(), head) != tail->next_blocks.end())
+				rotate(chain.begin(), chain.begin() + 1, chain.end());
+			chains.push_back(chain);
+		}
+	vector<int> placed_chain(chains.size());
+	vector<int> layout;
+	for (int k = 0; k < chains.size(); k++) {
+		int best = -1;
+		double best_weight = -1;
+		for (int c = 0; c < chains.size(); c++) {
+			if (placed_chain[c])
+				continue;
+			double weight = 0;
+			if (layout.empty())
+				weight = find(chains[c].begin(), chains[c].end(), 0) != chains[c].end();
+			else
+				for (auto &edge: edges)
+					if (edge.second.second == chains[c][0] && edge.second.first == layout.back())
+						weight = max(weight, edge.first + 1e9);
+					else if (find(chains[c].begin(), chains[c].end(), edge.second.second) != chains[c].end() &&
+						find(layout.begin(), layout.end(), edge.second.first) != layout.end())
+						weight = max(weight, edge.first);
+			if (weight > best_weight) {
+				best_weight = weight;
+				best = c;
+			}
+		}
+		placed_chain[best] = 1;
+		layout.insert(layout.end(), chains[best].begin(), chains[best].end());
+	}
+	vector<unique_ptr<Block> > new_blocks;
+	for (int i: layout)
+		new_blocks.push_back(move(ptr->blocks[i]));
+	ptr->blocks = move(new_blocks);
+}
+
+int GetStmtLatency(Statement *stmt, const set<string> &reg_allocs) {
+	if (stmt->stmt_type != SYMBOLDEFSTMT)
+		return 1;
+	auto symb_def = static_cast<SymbolDef*>(stmt);
+	if (symb_def->def_type == LOADDEF) {
+		auto load_def = static_cast<LoadDef*>(symb_def);
+		return reg_allocs.count(load_def->load->symbol) ? 1 : 3;
+	} else if (symb_def->def_type == BINEXPRDEF) {
+		string op = static_cast<BinExprDef*>(symb_def)->bin_expr->op;
+		if (op == "mul")
+			return 3;
+		if (op == "div" || op == "mod")
+			return 11;
+	}
+	return 1;
+}
+
+int IsCallStmt(Statement *stmt) {
+	if (stmt->stmt_type == FUNCALLSTMT)
+		return 1;
+	return stmt->stmt_type == SYMBOLDEFSTMT &&
+		static_cast<SymbolDef*>(stmt)->def_type == FUNCALLDEF;
+}
+
+// returns the symbol whose memory stmt reads or writes; a pointer or
+// global access returns "" and may alias any other such access
+int GetMemAccess(Statement *stmt, const set<string> &reg_allocs, string &symbol) {
+	symbol.clear();
+	if (stmt->stmt_type == STORESTMT) {
+		auto store = static_cast<Store*>(stmt);
+		if (reg_allocs.count(store->symbol))
+			symbol = store->symbol;
+		return 2;
+	}
+	if (stmt->stmt_type == SYMBOLDEFSTMT && static_cast<SymbolDef*>(stmt)->def_type == LOADDEF) {
+		auto load_def = static_cast<LoadDef*>(stmt);
+		if (reg_allocs.count(load_def->load->symbol))
+			symbol = load_def->load->symbol;
+		return 1;
+	}
+	return 0;
+}
+
+void ScheduleStmtSegment(vector<unique_ptr<Statement> > &stmts, int begin, int end,
+const set<string> &reg_allocs) {
+	int n = end - begin;
+	if (n <= 2)
+		return;
+	vector<vector<pair<int, int> > > deps(n);
+	vector<set<string> > stmt_uses(n);
+	map<string, string> loaded_from;
+	for (int j = 0; j < n; j++) {
+		Statement *stmt_j = stmts[begin + j].get();
+		set<string> &uses = stmt_uses[j];
+		GetStmtUses(stmt_j, uses);
+		string symb_j;
+		int mem_j = GetMemAccess(stmt_j, reg_allocs, symb_j);
+		if (mem_j == 1 && !symb_j.empty())
+			loaded_from[static_cast<SymbolDef*>(stmt_j)->symbol] = symb_j;
+		for (int i = 0; i < j; i++) {
+			Statement *stmt_i = stmts[begin + i].get();
+			int lat = -1;
+			if (stmt_i->stmt_type == SYMBOLDEFSTMT &&
+				uses.count(static_cast<SymbolDef*>(stmt_i)->symbol))
+				lat = GetStmtLatency(stmt_i, reg_allocs);
+			string symb_i;
+			int mem_i = GetMemAccess(stmt_i, reg_allocs, symb_i);
+			if (mem_i && mem_j && (mem_i == 2 || mem_j == 2) && symb_i == symb_j)
+				lat = max(lat, mem_i == 2 ? 1 : 0);
+			// keep copies of an alloc coalescable with it: a load or store
+			// of the alloc stays after earlier uses of values loaded from it
+			if (mem_j && !symb_j.empty())
+				for (string var: stmt_uses[i])
+					if (loaded_from.count(var) && loaded_from[var] == symb_j)
+						lat = max(lat, 0);
+			if (lat >= 0)
+				deps[j].push_back(make_pair(i, lat));
+		}
+	}
+	vector<int> order;
+	ListSchedule(deps, order);
+	vector<unique_ptr<Statement> > new_stmts;
+	for (int i: order)
+		new_stmts.push_back(move(stmts[begin + i]));
+	for (int i = 0; i < n; i++)
+		stmts[begin + i] = move(new_stmts[i]);
+}
+
+void ScheduleStmts(FunBody *ptr) {
+	set<string> reg_allocs;
+	GetRegAllocs(ptr, reg_allocs);
+	for (auto &block: ptr->blocks) {
+		auto &stmts = block->stmts;
+		int begin = 0;
+		for (int i = 0; i <= stmts.size(); i++)
+			if (i == stmts.size() || IsCallStmt(stmts[i].get())) {
+				ScheduleStmtSegment(stmts, begin, i, reg_allocs);
+				begin = i + 1;
+			}
+	}
+}
+
+// the symbol a load, store, getptr or getelemptr addresses through
+string *GetBaseSymbol(Statement *stmt) {
+	if (stmt->stmt_type == STORESTMT)
+		return &static_cast<Store*>(stmt)->symbol;
+	if (stmt->stmt_type != SYMBOLDEFSTMT)
+		return nullptr;
+	auto symb_def = static_cast<SymbolDef*>(stmt);
+	if (symb_def->def_type == LOADDEF)
+		return &static_cast<LoadDef*>(symb_def)->load->symbol;
+	if (symb_def->def_type == GETPTRDEF)
+		return &static_cast<GetPtrDef*>(symb_def)->get_ptr->symbol;
+	if (symb_def->def_type == GETELEMPTRDEF)
+		return &static_cast<GetElemPtrDef*>(symb_def)->get_elem_ptr->symbol;
+	return nullptr;
+}
+
+// a global accessed inside a loop gets its address computed once, as
+// "%hoist_g = getptr @g, 0" in the deepest loop-free block dominating all
+// its uses, so that the address can live in a register (the backend
+// rematerializes it with la when it does not)
+void HoistGlobalAddrs(FunBody *ptr, FunParams *params) {
+	set<string> locals;
+	for (auto &param: params->params)
+		locals.insert(param.first);
+	for (auto &block: ptr->blocks)
+		for (auto &stmt: block->stmts)
+			if (stmt->stmt_type == SYMBOLDEFSTMT)
+				locals.insert(static_cast<SymbolDef*>(stmt.get())->symbol);
+	map<Block*, int> depth;
+	GetLoopDepth(ptr, depth);
+	map<string, set<Block*> > use_blocks;
+	set<string> in_loop;
+	for (auto &block: ptr->blocks)
+		for (auto &stmt: block->stmts) {
+			string *base = GetBaseSymbol(stmt.get());
+			if (!base || locals.count(*base))
+				continue;
+			use_blocks[*base].insert(block.get());
+			if (depth[block.get()] > 0)
+				in_loop.insert(*base);
+		}
+	if (in_loop.empty())
+		return;
+	map<Block*, set<Block*> > dom;
+	GetDominators(ptr, dom);
+	for (string global: in_loop) {
+		Block *best = nullptr;
+		for (auto &block: ptr->blocks) {
+			if (depth[block.get()] > 0)
+				continue;
+			int dom_all = 1;
+			for (Block *use: use_blocks[global])
+				if (!dom[use].count(block.get()))
+					dom_all = 0;
+			if (dom_all && (!best || dom[block.get()].size() > dom[best].size()))
+				best = block.get();
+		}
+		assert(best);
+		string hoisted = "%hoist_" + global.substr(1);
+		for (auto &block: ptr->blocks)
+			for (auto &stmt: block->stmts) {
+				string *base = GetBaseSymbol(stmt.get());
+				if (base && *base == global)
+					*base = hoisted;
+			}
+		auto &stmts = best->stmts;
+		int pos = 0;
+		while (pos < stmts.size()) {
+			string *base = GetBaseSymbol(stmts[pos].get());
+			if (base && *base == hoisted)
+				break;
+			pos++;
+		}
+		auto get_ptr = make_unique<GetPointer>(global, make_unique<IntValue>(0));
+		stmts.insert(stmts.begin() + pos, make_unique<GetPtrDef>(hoisted, move(get_ptr)));
+	}
+}
+
+string FindLeader(map<string, string> &leader, string var) {
+	while (leader[var] != var) {
+		leader[var] = leader[leader[var]];
+		var = leader[var];
+	}
+	return var;
+}
+
+void AddEdge(map<string, set<string> > &edges, string var1, string var2) {
+	edges[var1].insert(var2);
+	edges[var2].insert(var1);
+}
+
+int GetCallClobbers(FunCall *fun_call) {
+	int mask = 1 << 17;
+	for (int i = 0; i < 8 && i < fun_call->params.size(); i++)
+		mask |= 1 << (i + 17);
+	if (fun_clobbers.count(fun_call->symbol))
+		mask |= fun_clobbers[fun_call->symbol];
+	else
+		for (int i = callee_regs; i < max_regs; i++)
+			mask |= 1 << i;
+	return mask;
+}
+
+void AddCallHints(FunCall *fun_call, const set<string> &live_out, int weight,
+map<string, vector<int> > &reg_hints, map<string, int> &cross_call,
+map<string, int> &clobbered) {
+	for (int i = 0; i < 8 && i < fun_call->params.size(); i++) {
+		auto val = fun_call->params[i].get();
+		if (val->val_type == SYMBOLVALUE) {
+			auto symb_val = static_cast<SymbolValue*>(val);
+			if (!live_out.count(symb_val->symbol))
+				reg_hints[symb_val->symbol].push_back(i + 17);
+		}
+	}
+	int mask = GetCallClobbers(fun_call);
+	for (string var: live_out) {
+		cross_call[var] += weight;
+		clobbered[var] |= mask;
+	}
+}
+
+void GetPartnerRegs(string cur, const vector<pair<string, string> > &move_pairs,
+map<string, string> &leader, map<string, int> &color, vector<int> &prefer) {
+	for (auto &pr: move_pairs) {
+		string var1 = FindLeader(leader, pr.first);
+		string var2 = FindLeader(leader, pr.second);
+		if (var2 == cur)
+			swap(var1, var2);
+		if (var1 == cur && color.count(var2) && color[var2] >= 0)
+			prefer.push_back(color[var2]);
+	}
+}
+
+int ChooseReg(string cur, map<string, set<string> > &edges, map<string, int> &color,
+const vector<int> &prefer, int cross_call, int caller_only, int clobbered) {
+	int colored[max_regs] = {};
+	for (string nxt: edges[cur])
+		if (color.count(nxt) && color[nxt] >= 0)
+			colored[color[nxt]] = 1;
+	if (caller_only)
+		for (int i = 0; i < callee_regs; i++)
+			colored[i] = 1;
+	for (int reg: prefer)
+		if (!colored[reg] && !(clobbered >> reg & 1))
+			return reg;
+	for (int i = callee_regs; i < max_regs; i++)
+		if (!colored[i] && !(clobbered >> i & 1))
+			return i;
+	if (cross_call)
+		for (int i = 0; i < callee_regs; i++)
+			if (!colored[i])
+				return i;
+	for (int reg: prefer)
+		if (!colored[reg])
+			return reg;
+	for (int i = callee_regs; i < max_regs; i++)
+		if (!colored[i])
+			return i;
+	for (int i = 0; i < callee_regs; i++)
+		if (!colored[i])
+			return i;
+	return -1;
+}
+
+void AllocRegs(FunBody *ptr, FunParams *params, map<string, int> &var2reg,
+map<string, int> &used_vars, const set<string> &pre_vars) {
+	set<string> reg_allocs;
+	GetRegAllocs(ptr, reg_allocs);
 	set<string> defed_vars;
+	map<string, int> precolored;
+	map<string, string> leader;
 	map<string, set<string> > edges;
-	map<string, int> degree;
-	map<string, int> spill_cost;
+	map<string, vector<int> > reg_hints;
+	map<string, int> cross_call;
+	map<string, int> clobbered;
+	vector<pair<int, pair<string, string> > > copies;
+	for (int i = 0; i < 8 && i < params->params.size(); i++)
+		precolored[params->params[i].first] = i + 17;
 	for (auto &block: ptr->blocks) {
 		for (auto &stmt: block->stmts)
 			if (stmt->stmt_type == SYMBOLDEFSTMT) {
@@ -287,108 +815,171 @@ void AllocRegs(FunBody *ptr, map<string, int> &var2reg, map<string, int> &used_v
 				var2reg[symb_def->symbol] = -1;
 			}
 	}
+	for (string var: defed_vars)
+		leader[var] = var;
+	for (auto &pr: precolored)
+		leader[pr.first] = pr.first;
 	for (auto &block: ptr->blocks) {
-		auto end_stmt = block->end_stmt.get();
-		for (string var1: end_stmt->live_vars)
-			for (string var2: end_stmt->live_vars)
-				if (var1 != var2 && defed_vars.count(var1) && defed_vars.count(var2)) {
-					edges[var1].insert(var2);
-					edges[var2].insert(var1);
-				}
+		int weight = GetBlockWeight(block.get());
+		vector<Statement*> block_stmts;
 		for (auto &stmt: block->stmts)
-			for (string var1: stmt->live_vars)
-				for (string var2: stmt->live_vars)
-					if (var1 != var2 && defed_vars.count(var1) && defed_vars.count(var2)) {
-						edges[var1].insert(var2);
-						edges[var2].insert(var1);
+			block_stmts.push_back(stmt.get());
+		block_stmts.push_back(block->end_stmt.get());
+		for (Statement *stmt: block_stmts) {
+			set<string> live_out;
+			GetLiveOut(stmt, live_out);
+			string def, src;
+			if (stmt->stmt_type == SYMBOLDEFSTMT) {
+				auto symb_def = static_cast<SymbolDef*>(stmt);
+				if (symb_def->def_type != MEMORYDEF)
+					def = symb_def->symbol;
+				if (symb_def->def_type == LOADDEF) {
+					auto load_def = static_cast<LoadDef*>(symb_def);
+					if (reg_allocs.count(load_def->load->symbol))
+						src = load_def->load->symbol;
+				} else if (symb_def->def_type == FUNCALLDEF) {
+					auto fun_def = static_cast<FunCallDef*>(symb_def);
+					AddCallHints(fun_def->fun_call.get(), live_out, weight, reg_hints, cross_call, clobbered);
+					reg_hints[def].push_back(17);
+				}
+			} else if (stmt->stmt_type == STORESTMT) {
+				auto store = static_cast<Store*>(stmt);
+				if (reg_allocs.count(store->symbol)) {
+					def = store->symbol;
+					if (store->store_type == VALUESTORE) {
+						auto val_store = static_cast<ValueStore*>(store);
+						if (val_store->val->val_type == SYMBOLVALUE)
+							src = static_cast<SymbolValue*>(val_store->val.get())->symbol;
 					}
+				}
+			} else if (stmt->stmt_type == FUNCALLSTMT) {
+				auto fun_call = static_cast<FunCall*>(stmt);
+				AddCallHints(fun_call, live_out, weight, reg_hints, cross_call, clobbered);
+			} else if (stmt->stmt_type == RETURNEND) {
+				auto ret = static_cast<Return*>(stmt);
+				if (ret->val && ret->val->val_type == SYMBOLVALUE)
+					reg_hints[static_cast<SymbolValue*>(ret->val.get())->symbol].push_back(17);
+			}
+			if (!defed_vars.count(def))
+				continue;
+			for (string var: live_out)
+				if (var != def && var != src && leader.count(var))
+					AddEdge(edges, def, var);
+			if (leader.count(src))
+				copies.push_back(make_pair(weight, make_pair(def, src)));
+		}
+	}
+	sort(copies.rbegin(), copies.rend());
+	vector<pair<string, string> > move_pairs;
+	for (auto &cp: copies) {
+		string var1 = FindLeader(leader, cp.second.first);
+		string var2 = FindLeader(leader, cp.second.second);
+		if (var1 == var2)
+			continue;
+		if (edges[var1].count(var2)) {
+			move_pairs.push_back(cp.second);
+			continue;
+		}
+		if (precolored.count(var1))
+			swap(var1, var2);
+		if (precolored.count(var1) ||
+			(precolored.count(var2) && cross_call[var1])) {
+			move_pairs.push_back(cp.second);
+			continue;
+		}
+		set<string> adj(edges[var1]);
+		adj.insert(edges[var2].begin(), edges[var2].end());
+		int significant = 0;
+		for (string nxt: adj)
+			if (precolored.count(nxt) || edges[nxt].size() >= max_regs)
+				significant++;
+		if (significant >= max_regs) {
+			move_pairs.push_back(cp.second);
+			continue;
+		}
+		for (string nxt: edges[var1]) {
+			edges[nxt].erase(var1);
+			AddEdge(edges, var2, nxt);
+		}
+		edges.erase(var1);
+		leader[var1] = var2;
+		cross_call[var2] += cross_call[var1];
+		clobbered[var2] |= clobbered[var1];
+		auto &hints = reg_hints[var2];
+		hints.insert(hints.end(), reg_hints[var1].begin(), reg_hints[var1].end());
+	}
+	set<string> nodes;
+	map<string, int> degree;
+	map<string, int> spill_cost;
+	for (string var: defed_vars) {
+		string cur = FindLeader(leader, var);
+		spill_cost[cur] += used_vars[var];
+		if (!precolored.count(cur))
+			nodes.insert(cur);
 	}
-	for (auto pr: edges)
-		degree[pr.first] = pr.second.size();
+	for (string var: nodes)
+		degree[var] = edges[var].size();
 	vector<string> free_vars;
 	vector<string> spilled_vars;
-	while (!defed_vars.empty()) {
+	while (!nodes.empty()) {
 		queue<string> q;
-		for (string var: defed_vars) {
+		for (string var: nodes) {
 			if (degree[var] < max_regs)
 				q.push(var);
 		}
 		while(!q.empty()) {
 			string cur = q.front();
 			q.pop();
-			if (!defed_vars.count(cur))
+			if (!nodes.count(cur))
 				continue;
-			defed_vars.erase(cur);
+			nodes.erase(cur);
 			free_vars.push_back(cur);
 			for (string nxt: edges[cur])
-				if (defed_vars.count(nxt))
+				if (nodes.count(nxt))
 					if (--degree[nxt] < max_regs) {
 						q.push(nxt);
 					}
 		}
-		if (defed_vars.empty())
+		if (nodes.empty())
 			break;
 		double min_cost = 1e18;
 		string max_var;
-		for (auto var: defed_vars)
-			if (used_vars[var] / degree[var] < min_cost) {
-				min_cost = used_vars[var] / degree[var];
+		for (auto var: nodes)
+			if (spill_cost[var] / degree[var] < min_cost) {
+				min_cost = spill_cost[var] / degree[var];
 				max_var = var;
 			}
-		defed_vars.erase(max_var);
+		nodes.erase(max_var);
 		spilled_vars.push_back(max_var);
-		var2reg[max_var] = -1;
 		for (string nxt: edges[max_var])
-			if (defed_vars.count(nxt))
+			if (nodes.count(nxt))
 				degree[nxt]--;
 	}
+	set<string> caller_only;
+	for (string var: pre_vars)
+		if (leader.count(var))
+			caller_only.insert(FindLeader(leader, var));
+	map<string, int> color(precolored);
 	while(!free_vars.empty()) {
 		string cur = free_vars.back();
 		free_vars.pop_back();
-		int colored[max_regs] = {};
-		for (string nxt: edges[cur])
-			if (var2reg[nxt] >= 0) {
-				colored[var2reg[nxt]] = 1;
-			}
-		for (int i = 0; i < max_regs; i++)
-			if (!colored[i])
-			{
-				var2reg[cur] = i;
-				break;
-			}
-		assert(var2reg[cur] != -1);
+		vector<int> prefer(reg_hints[cur]);
+		GetPartnerRegs(cur, move_pairs, leader, color, prefer);
+		color[cur] = ChooseReg(cur, edges, color, prefer,
+			cross_call[cur] > 1, caller_only.count(cur), clobbered[cur]);
+		assert(color[cur] != -1 || caller_only.count(cur));
 	}
 	mt19937 rnd(514);
 	shuffle(spilled_vars.begin(), spilled_vars.end(), rnd);
 	for (string cur: spilled_vars) {
-		int colored[max_regs] = {};
-		for (string nxt: edges[cur])
-			if (var2reg[nxt] >= 0) {
-				colored[var2reg[nxt]] = 1;
-			}
-		for (int i = 0; i < max_regs; i++)
-			if (!colored[i])
-			{
-				var2reg[cur] = i;
-				break;
-			}
+		vector<int> prefer(reg_hints[cur]);
+		GetPartnerRegs(cur, move_pairs, leader, color, prefer);
+		color[cur] = ChooseReg(cur, edges, color, prefer,
+			cross_call[cur] > 1, caller_only.count(cur), clobbered[cur]);
 	}
-	int banned[8] = {};
-	int remap_regs[25] = {};
-	for (int i = 0; i < 25;i ++)
-		remap_regs[i] = i;
-	for (auto &pr: var2reg) {
-		string name = pr.first;
-		int reg = pr.second;
-		if (name[0] == '%' && !(name[1] >= '0' && name[1] <= '9')) {
-			if (reg >= 17)
-				banned[reg-17] = 1;
-		}
+	for (string var: defed_vars) {
+		string cur = FindLeader(leader, var);
+		if (color.count(cur))
+			var2reg[var] = color[cur];
 	}
-	for (int i = 0; i < 8; i++)
-		if (banned[i])
-			swap(remap_regs[i], remap_regs[i+17]);
-	for (auto &pr: var2reg)
-		if(pr.second >= 0)
-			pr.second = remap_regs[pr.second];
 }
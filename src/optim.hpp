@@ -11,9 +11,28 @@
 
 void BuildBlockCFG(koopa::FunBody *ptr);
 void CutDeadBlocks(koopa::FunBody *ptr);
-void CountUsedVars(koopa::Block *block, std::map<std::string, int> &used_vars);
+int GetBlockWeight(koopa::Block *block);
+void GetRegAllocs(koopa::FunBody *ptr, std::set<std::string> &reg_allocs);
+void GetStmtUses(koopa::Statement *stmt, std::set<std::string> &uses);
+void CountUsedVars(koopa::Block *block, std::map<std::string, int> &used_vars,
+const std::set<std::string> &reg_allocs);
 void CutDeadVars(koopa::FunBody *ptr, std::map<std::string, int> &used_vars);
 void BuildStmtCFG(koopa::FunBody *ptr);
 void GetLiveVars(koopa::FunBody *ptr);
-void AllocRegs(koopa::FunBody *ptr,
-std::map<std::string, int> &var2reg, std::map<std::string, int> &used_vars);
+void GetLiveOut(koopa::Statement *stmt, std::set<std::string> &live_out);
+void GetDominators(koopa::FunBody *ptr,
+std::map<koopa::Block*, std::set<koopa::Block*> > &dom);
+void GetReachable(koopa::Block *start, std::set<koopa::Block*> &reached);
+void GetStackBlocks(koopa::FunBody *ptr, koopa::FunParams *params,
+std::set<koopa::Block*> &need_blocks);
+koopa::Block *GetSavePoint(koopa::FunBody *ptr, const std::set<koopa::Block*> &need_blocks,
+std::set<koopa::Block*> &frame_blocks);
+void GetPreRegionVars(koopa::FunBody *ptr, const std::set<koopa::Block*> &frame_blocks,
+std::set<std::string> &pre_vars);
+int GetCallClobbers(koopa::FunCall *fun_call);
+void GetLoopDepth(koopa::FunBody *ptr, std::map<koopa::Block*, int> &depth);
+void LayoutBlocks(koopa::FunBody *ptr);
+void ScheduleStmts(koopa::FunBody *ptr);
+void HoistGlobalAddrs(koopa::FunBody *ptr, koopa::FunParams *params);
+void AllocRegs(koopa::FunBody *ptr, koopa::FunParams *params, std::map<std::string, int> &var2reg,
+std::map<std::string, int> &used_vars, const std::set<std::string> &pre_vars);
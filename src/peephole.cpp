@@ -0,0 +1,290 @@
+#include <memory>
+#include <vector>
+#include <string>
+#include <cassert>
+#include "riscv.hpp"
+#include "peephole.hpp"
+
+using namespace std;
+
+typedef vector<unique_ptr<riscv::Item> > Code;
+
+riscv::Instr *GetInstr(Code &code, int pos, int instr_type = -1) {
+	if (pos < 0 || pos >= code.size() || code[pos]->item_type != riscv::INSTR)
+		return nullptr;
+	auto instr = static_cast<riscv::Instr*>(code[pos].get());
+	if (instr_type >= 0 && instr->instr_type != instr_type)
+		return nullptr;
+	return instr;
+}
+
+int IsControl(riscv::Item *item) {
+	if (item->item_type == riscv::LABEL)
+		return 1;
+	if (item->item_type != riscv::INSTR)
+		return 0;
+	auto instr = static_cast<riscv::Instr*>(item);
+	return instr->instr_type == riscv::LABELINSTR && instr->op != riscv::LA;
+}
+
+int UsesReg(riscv::Instr *instr, riscv::Reg reg) {
+	riscv::Reg uses[2];
+	int cnt = instr->Uses(uses);
+	for (int i = 0; i < cnt; i++)
+		if (uses[i] == reg)
+			return 1;
+	return 0;
+}
+
+// reg is dead after pos if it is redefined before any use in the same
+// block; t0/t1 are scratch and never live across blocks
+int IsDeadAfter(Code &code, int pos, riscv::Reg reg) {
+	for (int i = pos + 1; i < code.size(); i++) {
+		auto item = code[i].get();
+		if (item->item_type == riscv::INSTR) {
+			auto instr = static_cast<riscv::Instr*>(item);
+			if (UsesReg(instr, reg))
+				return 0;
+			if (instr->Def() == reg)
+				return 1;
+		}
+		if (IsControl(item))
+			return reg == riscv::T0 || reg == riscv::T1;
+	}
+	return reg == riscv::T0 || reg == riscv::T1;
+}
+
+int FitsImm12(int imm) {
+	return imm >= -2048 && imm < 2048;
+}
+
+// mv x, x
+int CutSelfMove(Code &code, int pos) {
+	auto instr = GetInstr(code, pos, riscv::REGINSTR);
+	if (!instr || instr->op != riscv::MV)
+		return 0;
+	auto mv = static_cast<riscv::RegInstr*>(instr);
+	if (mv->rd != mv->rs1)
+		return 0;
+	code.erase(code.begin() + pos);
+	return 1;
+}
+
+// addi/xori/ori x, y, 0 -> mv x, y
+int ImmZero(Code &code, int pos) {
+	auto instr = GetInstr(code, pos, riscv::IMMINSTR);
+	if (!instr || (instr->op != riscv::ADDI && instr->op != riscv::XORI && instr->op != riscv::ORI))
+		return 0;
+	auto imm_instr = static_cast<riscv::ImmInstr*>(instr);
+	if (imm_instr->imm != 0 || imm_instr->rs == riscv::SP || imm_instr->rd == riscv::SP)
+		return 0;
+	code[pos] = make_unique<riscv::RegInstr>(riscv::MV, imm_instr->rd, imm_instr->rs, riscv::NOREG);
+	return 1;
+}
+
+// li t, imm; op x, y, t -> opi x, y, imm
+int FoldImm(Code &code, int pos) {
+	auto instr1 = GetInstr(code, pos, riscv::IMMINSTR);
+	auto instr2 = GetInstr(code, pos + 1, riscv::REGINSTR);
+	if (!instr1 || !instr2 || instr1->op != riscv::LI)
+		return 0;
+	auto li = static_cast<riscv::ImmInstr*>(instr1);
+	auto op = static_cast<riscv::RegInstr*>(instr2);
+	riscv::Reg t = li->rd;
+	if (op->rs2 == riscv::NOREG || op->rs1 == op->rs2)
+		return 0;
+	riscv::Reg rs = op->rs2 == t ? op->rs1 : op->rs2;
+	int imm = li->imm;
+	riscv::OpCode new_op;
+	if (op->op == riscv::ADD || op->op == riscv::XOR || op->op == riscv::OR || op->op == riscv::AND) {
+		if (op->rs1 != t && op->rs2 != t)
+			return 0;
+		new_op = op->op == riscv::ADD ? riscv::ADDI :
+			op->op == riscv::XOR ? riscv::XORI :
+			op->op == riscv::OR ? riscv::ORI : riscv::ANDI;
+	} else if (op->op == riscv::SUB || op->op == riscv::SLT) {
+		if (op->rs2 != t)
+			return 0;
+		new_op = op->op == riscv::SUB ? riscv::ADDI : riscv::SLTI;
+		if (op->op == riscv::SUB)
+			imm = -imm;
+	} else if (op->op == riscv::SLL || op->op == riscv::SRL || op->op == riscv::SRA) {
+		if (op->rs2 != t || imm < 0 || imm >= 32)
+			return 0;
+		new_op = op->op == riscv::SLL ? riscv::SLLI :
+			op->op == riscv::SRL ? riscv::SRLI : riscv::SRAI;
+	} else
+		return 0;
+	if (!FitsImm12(imm))
+		return 0;
+	if (op->rd != t && !IsDeadAfter(code, pos + 1, t))
+		return 0;
+	auto new_instr = make_unique<riscv::ImmInstr>(new_op, op->rd, rs, imm);
+	code.erase(code.begin() + pos);
+	code[pos] = move(new_instr);
+	return 1;
+}
+
+// j L; L: -> L:
+int CutJumpNext(Code &code, int pos) {
+	auto instr = GetInstr(code, pos, riscv::LABELINSTR);
+	if (!instr || instr->op != riscv::J || pos + 1 >= code.size())
+		return 0;
+	auto jump = static_cast<riscv::LabelInstr*>(instr);
+	auto item = code[pos + 1].get();
+	if (item->item_type != riscv::LABEL || static_cast<riscv::Label*>(item)->name != jump->label)
+		return 0;
+	code.erase(code.begin() + pos);
+	return 1;
+}
+
+// bnez x, L1; j L2; L1: -> beqz x, L2; L1:
+int InvertBranch(Code &code, int pos) {
+	auto instr1 = GetInstr(code, pos, riscv::LABELINSTR);
+	auto instr2 = GetInstr(code, pos + 1, riscv::LABELINSTR);
+	if (!instr1 || !instr2 || instr2->op != riscv::J || pos + 2 >= code.size())
+		return 0;
+	if (instr1->op != riscv::BNEZ && instr1->op != riscv::BEQZ)
+		return 0;
+	auto br = static_cast<riscv::LabelInstr*>(instr1);
+	auto jump = static_cast<riscv::LabelInstr*>(instr2);
+	auto item = code[pos + 2].get();
+	if (item->item_type != riscv::LABEL || static_cast<riscv::Label*>(item)->name != br->label)
+		return 0;
+	riscv::OpCode new_op = br->op == riscv::BNEZ ? riscv::BEQZ : riscv::BNEZ;
+	auto new_br = make_unique<riscv::LabelInstr>(new_op, br->rd, jump->label);
+	code.erase(code.begin() + pos);
+	code[pos] = move(new_br);
+	return 1;
+}
+
+int IsBoolOp(riscv::OpCode op) {
+	return op == riscv::SLT || op == riscv::SGT || op == riscv::SLTI ||
+		op == riscv::SEQZ || op == riscv::SNEZ;
+}
+
+// slt/sgt/slti/seqz/snez x, ...; snez y, x -> ...; mv y, x
+int CutBoolSnez(Code &code, int pos) {
+	auto instr1 = GetInstr(code, pos);
+	auto instr2 = GetInstr(code, pos + 1, riscv::REGINSTR);
+	if (!instr1 || !instr2 || !IsBoolOp(instr1->op) || instr2->op != riscv::SNEZ)
+		return 0;
+	auto snez = static_cast<riscv::RegInstr*>(instr2);
+	if (snez->rs1 != instr1->Def())
+		return 0;
+	code[pos + 1] = make_unique<riscv::RegInstr>(riscv::MV, snez->rd, snez->rs1, riscv::NOREG);
+	return 1;
+}
+
+// seqz/snez x, y; seqz/snez x, x -> seqz/snez x, y
+// seqz/snez x, y; bnez/beqz x, L -> bnez/beqz y, L
+int FoldSetZero(Code &code, int pos) {
+	auto instr1 = GetInstr(code, pos, riscv::REGINSTR);
+	auto instr2 = GetInstr(code, pos + 1);
+	if (!instr1 || !instr2 || (instr1->op != riscv::SEQZ && instr1->op != riscv::SNEZ))
+		return 0;
+	auto set = static_cast<riscv::RegInstr*>(instr1);
+	int inv = set->op == riscv::SEQZ;
+	if (instr2->op == riscv::SEQZ || instr2->op == riscv::SNEZ) {
+		auto set2 = static_cast<riscv::RegInstr*>(instr2);
+		if (set2->rs1 != set->rd)
+			return 0;
+		inv ^= set2->op == riscv::SEQZ;
+		riscv::OpCode new_op = inv ? riscv::SEQZ : riscv::SNEZ;
+		if (set2->rd != set->rd && !IsDeadAfter(code, pos + 1, set->rd))
+			return 0;
+		auto new_set = make_unique<riscv::RegInstr>(new_op, set2->rd, set->rs1, riscv::NOREG);
+		code.erase(code.begin() + pos);
+		code[pos] = move(new_set);
+		return 1;
+	}
+	if (instr2->op == riscv::BEQZ || instr2->op == riscv::BNEZ) {
+		auto br = static_cast<riscv::LabelInstr*>(instr2);
+		if (br->rd != set->rd || !IsDeadAfter(code, pos + 1, set->rd))
+			return 0;
+		inv ^= br->op == riscv::BEQZ;
+		riscv::OpCode new_op = inv ? riscv::BEQZ : riscv::BNEZ;
+		auto new_br = make_unique<riscv::LabelInstr>(new_op, set->rs1, br->label);
+		code.erase(code.begin() + pos);
+		code[pos] = move(new_br);
+		return 1;
+	}
+	return 0;
+}
+
+// sw/lw x, imm(rs) ... lw y, imm(rs) -> mv y, x
+// sw/lw x, imm(rs) ... sw x, imm(rs) -> removed
+// as long as neither x, rs nor the slot changes in between
+int CutReload(Code &code, int pos) {
+	auto instr = GetInstr(code, pos, riscv::IMMINSTR);
+	if (!instr || (instr->op != riscv::SW && instr->op != riscv::LW))
+		return 0;
+	auto mem1 = static_cast<riscv::ImmInstr*>(instr);
+	if (mem1->op == riscv::LW && mem1->rd == mem1->rs)
+		return 0;
+	for (int i = pos + 1; i < code.size(); i++) {
+		if (IsControl(code[i].get()))
+			return 0;
+		auto cur = GetInstr(code, i);
+		if (!cur)
+			continue;
+		if (cur->op == riscv::LW || cur->op == riscv::SW) {
+			auto mem2 = static_cast<riscv::ImmInstr*>(cur);
+			int same = mem2->rs == mem1->rs && mem2->imm == mem1->imm;
+			if (same && mem2->op == riscv::LW) {
+				if (mem2->rd == mem1->rd)
+					code.erase(code.begin() + i);
+				else
+					code[i] = make_unique<riscv::RegInstr>(riscv::MV, mem2->rd, mem1->rd, riscv::NOREG);
+				return 1;
+			}
+			if (same && mem2->op == riscv::SW && mem2->rd == mem1->rd) {
+				code.erase(code.begin() + i);
+				return 1;
+			}
+			if (mem2->op == riscv::SW && (same || mem2->rs != mem1->rs))
+				return 0;
+		}
+		riscv::Reg def = cur->Def();
+		if (def == mem1->rd || def == mem1->rs)
+			return 0;
+	}
+	return 0;
+}
+
+struct PeepRule {
+	const char *name;
+	int (*apply)(Code &code, int pos);
+	int hits;
+};
+
+thread_local PeepRule peep_rules[] = {
+	{"self-move", CutSelfMove, 0},
+	{"imm-zero", ImmZero, 0},
+	{"fold-imm", FoldImm, 0},
+	{"jump-next", CutJumpNext, 0},
+	{"invert-branch", InvertBranch, 0},
+	{"bool-snez", CutBoolSnez, 0},
+	{"fold-setzero", FoldSetZero, 0},
+	{"reload", CutReload, 0},
+};
+
+void Peephole(Code &code, int start) {
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (int pos = start; pos < code.size(); pos++)
+			for (auto &rule: peep_rules)
+				while (pos < code.size() && rule.apply(code, pos)) {
+					rule.hits++;
+					changed = 1;
+				}
+	}
+}
+
+string PeepholeStats() {
+	string s;
+	for (auto &rule: peep_rules)
+		s += string(rule.name) + ": " + to_string(rule.hits) + "\n";
+	return s;
+}
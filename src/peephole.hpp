@@ -0,0 +1,9 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <string>
+#include "riscv.hpp"
+
+void Peephole(std::vector<std::unique_ptr<riscv::Item> > &code, int start);
+std::string PeepholeStats();
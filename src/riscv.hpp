@@ -42,20 +42,61 @@ class Label: public Item {
 		}
 };
 
+// physical registers, numbered as x0-x31
+enum Reg {
+	ZERO, RA, SP, GP, TP, T0, T1, T2,
+	S0, S1, A0, A1, A2, A3, A4, A5,
+	A6, A7, S2, S3, S4, S5, S6, S7,
+	S8, S9, S10, S11, T3, T4, T5, T6,
+	NUM_REGS,
+	NOREG = NUM_REGS
+};
+
+inline const char *RegName(Reg reg) {
+	static const char *names[NUM_REGS + 1] = {
+		"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+		"s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+		"a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+		"s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+		""};
+	return names[reg];
+}
+
+enum OpCode {
+	ADD, SUB, SLT, SGT, XOR, OR, AND, SLL, SRL, SRA, MUL, DIV, REM,
+	SEQZ, SNEZ, MV,
+	LW, SW, ADDI, XORI, ORI, ANDI, SLTI, SLLI, SRLI, SRAI, LI,
+	BEQZ, BNEZ, LA, J, CALL, RET,
+	NUM_OPS
+};
+
+inline const char *OpName(OpCode op) {
+	static const char *names[NUM_OPS] = {
+		"add", "sub", "slt", "sgt", "xor", "or", "and", "sll", "srl", "sra", "mul", "div", "rem",
+		"seqz", "snez", "mv",
+		"lw", "sw", "addi", "xori", "ori", "andi", "slti", "slli", "srli", "srai", "li",
+		"beqz", "bnez", "la", "j", "call", "ret"};
+	return names[op];
+}
+
 enum InstrType {
 	REGINSTR, // instr rd, rs1[, rs2]
 	IMMINSTR, // instr rd[, rs], imm/imm12
 	LABELINSTR // instr [rd, ]label
 };
 
+// Def() is the register written (NOREG if none), Uses() fills the
+// registers read and returns their count (at most 2)
 class Instr: public Item {
 	public:
 		InstrType instr_type;
-		std::string op;
-		Instr(InstrType a, std::string op):
+		OpCode op;
+		Instr(InstrType a, OpCode op):
 			Item(INSTR), instr_type(a), op(op) {}
 		virtual ~Instr() = default;
 		virtual std::string Str() const override = 0;
+		virtual Reg Def() const = 0;
+		virtual int Uses(Reg uses[]) const = 0;
 };
 
 
@@ -65,39 +106,59 @@ class Instr: public Item {
 // seqz/snez/mv rd, rs1
 class RegInstr: public Instr {
 	public:
-		std::string rd, rs1, rs2;
-		RegInstr(std::string op, std::string rd, std::string rs1, std::string rs2):
+		Reg rd, rs1, rs2;
+		RegInstr(OpCode op, Reg rd, Reg rs1, Reg rs2):
 			Instr(REGINSTR, op), rd(rd), rs1(rs1), rs2(rs2) {}
 		virtual std::string Str() const override {
-			std::string s = "\t" + op + " " + rd + ", " + rs1;
-			if (!rs2.empty())
-				s += ", " + rs2;
+			std::string s = std::string("\t") + OpName(op) + " " + RegName(rd) + ", " + RegName(rs1);
+			if (rs2 != NOREG)
+				s += std::string(", ") + RegName(rs2);
 			return s + "\n";
 		}
+		virtual Reg Def() const override {
+			return rd;
+		}
+		virtual int Uses(Reg uses[]) const override {
+			uses[0] = rs1;
+			if (rs2 == NOREG)
+				return 1;
+			uses[1] = rs2;
+			return 2;
+		}
 };
 
 
 // instr rd[, rs], imm/imm12
 
 // lw/sw rd, imm12(rs)
-// addi/xori/ori/andi rd, rs, imm12
+// addi/xori/ori/andi/slti/slli/srli/srai rd, rs, imm12
 // li rd, imm
 class ImmInstr: public Instr {
 	public:
-		std::string rd, rs;
+		Reg rd, rs;
 		int imm;
-		ImmInstr(std::string op, std::string rd, std::string rs, int imm):
+		ImmInstr(OpCode op, Reg rd, Reg rs, int imm):
 			Instr(IMMINSTR, op), rd(rd), rs(rs), imm(imm) {}
 		virtual std::string Str() const override {
-			std::string s = "\t" + op + " ";
-			if (op == "lw" || op == "sw")
-				return s + rd + ", " + std::to_string(imm) + "(" + rs + ")\n";
-			s += rd;
-			if (!rs.empty())
-				s += ", " + rs;
+			std::string s = std::string("\t") + OpName(op) + " " + RegName(rd);
+			if (op == LW || op == SW)
+				return s + ", " + std::to_string(imm) + "(" + RegName(rs) + ")\n";
+			if (rs != NOREG)
+				s += std::string(", ") + RegName(rs);
 			s += ", " + std::to_string(imm) + "\n";
 			return s;
 		}
+		virtual Reg Def() const override {
+			return op == SW ? NOREG : rd;
+		}
+		virtual int Uses(Reg uses[]) const override {
+			int cnt = 0;
+			if (op == SW)
+				uses[cnt++] = rd;
+			if (rs != NOREG)
+				uses[cnt++] = rs;
+			return cnt;
+		}
 };
 
 
@@ -108,16 +169,27 @@ class ImmInstr: public Instr {
 // ret
 class LabelInstr: public Instr {
 	public:
-		std::string rd, label;
-		LabelInstr(std::string op, std::string rd, std::string label):
+		Reg rd;
+		std::string label;
+		LabelInstr(OpCode op, Reg rd, std::string label):
 			Instr(LABELINSTR, op), rd(rd), label(label) {}
 		virtual std::string Str() const override {
-			if (!rd.empty() && !label.empty())
-				return "\t" + op + " " + rd + ", " + label + "\n";
+			if (rd != NOREG && !label.empty())
+				return std::string("\t") + OpName(op) + " " + RegName(rd) + ", " + label + "\n";
 			else if (!label.empty())
-				return "\t" + op + " " + label + "\n";
+				return std::string("\t") + OpName(op) + " " + label + "\n";
 			else
-				return "\t" + op + "\n";
+				return std::string("\t") + OpName(op) + "\n";
+		}
+		virtual Reg Def() const override {
+			return op == LA ? rd : NOREG;
+		}
+		virtual int Uses(Reg uses[]) const override {
+			if (op == BEQZ || op == BNEZ) {
+				uses[0] = rd;
+				return 1;
+			}
+			return 0;
 		}
 };
 
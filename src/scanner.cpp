@@ -0,0 +1,207 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "sysy.tab.hpp"
+#include "scanner.hpp"
+
+int FlexLex();
+
+int use_hand_scanner = 0;
+
+int yylex() {
+	return use_hand_scanner ? ScanToken() : FlexLex();
+}
+
+thread_local const char *scan_pos, *scan_end;
+
+// same buffer as LexBuffer, ending with two 0 bytes
+void ScanBuffer(const char *base, size_t size) {
+	scan_pos = base;
+	scan_end = base + size - 2;
+}
+
+// SWAR helpers on 8 bytes loaded little-endian: each returns a word with
+// the high bit of every matching byte set
+
+const uint64_t ones = 0x0101010101010101ull;
+const uint64_t highs = 0x8080808080808080ull;
+
+uint64_t Load8(const char *p) {
+	uint64_t x;
+	memcpy(&x, p, 8);
+	return x;
+}
+
+uint64_t ByteEq(uint64_t x, unsigned char c) {
+	uint64_t t = x ^ (ones * c);
+	return ~(((t & ~highs) + ~highs) | t) & highs;
+}
+
+// bytes in [lo, hi], lo and hi below 0x80
+uint64_t ByteIn(uint64_t x, unsigned char lo, unsigned char hi) {
+	uint64_t y = x | highs;
+	uint64_t ge = (y - ones * lo) & highs;
+	uint64_t gt = (y - ones * (hi + 1)) & highs;
+	return ge & ~gt & ~x;
+}
+
+uint64_t SpaceMask(uint64_t x) {
+	return ByteEq(x, ' ') | ByteEq(x, '\t') | ByteEq(x, '\n') | ByteEq(x, '\r');
+}
+
+uint64_t IdentMask(uint64_t x) {
+	return ByteIn(x | ones * 0x20, 'a', 'z') | ByteIn(x, '0', '9') | ByteEq(x, '_');
+}
+
+uint64_t DigitMask(uint64_t x) {
+	return ByteIn(x, '0', '9');
+}
+
+int IsSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+int IsIdent(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+int IsDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+// skip bytes whose mask bit is set, 8 at a time while a full word remains
+const char *SkipRun(const char *p, uint64_t (*mask)(uint64_t), int (*is)(char)) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (scan_end - p >= 8) {
+		uint64_t miss = ~mask(Load8(p)) & highs;
+		if (miss)
+			return p + (__builtin_ctzll(miss) >> 3);
+		p += 8;
+	}
+#endif
+	while (p < scan_end && is(*p))
+		p++;
+	return p;
+}
+
+// skip whitespace and comments, an unterminated block comment is not one
+void SkipBlank() {
+	for (;;) {
+		scan_pos = SkipRun(scan_pos, SpaceMask, IsSpace);
+		if (scan_end - scan_pos < 2 || scan_pos[0] != '/')
+			return;
+		if (scan_pos[1] == '/') {
+			auto p = static_cast<const char*>(memchr(scan_pos + 2, '\n', scan_end - scan_pos - 2));
+			scan_pos = p ? p : scan_end;
+		} else if (scan_pos[1] == '*') {
+			auto p = scan_pos + 2;
+			for (;;) {
+				p = static_cast<const char*>(memchr(p, '*', scan_end - p));
+				if (!p || p + 1 >= scan_end)
+					return;
+				if (p[1] == '/')
+					break;
+				p++;
+			}
+			scan_pos = p + 2;
+		} else
+			return;
+	}
+}
+
+int Keyword(const char *s, int len) {
+	switch (len) {
+		case 2:
+			if (!memcmp(s, "if", 2)) return IF;
+			break;
+		case 3:
+			if (!memcmp(s, "int", 3)) return INT;
+			break;
+		case 4:
+			if (!memcmp(s, "void", 4)) return VOID;
+			if (!memcmp(s, "else", 4)) return ELSE;
+			break;
+		case 5:
+			if (!memcmp(s, "while", 5)) return WHILE;
+			if (!memcmp(s, "break", 5)) return BREAK;
+			if (!memcmp(s, "const", 5)) return CONST;
+			break;
+		case 6:
+			if (!memcmp(s, "return", 6)) return RETURN;
+			break;
+		case 8:
+			if (!memcmp(s, "continue", 8)) return CONTINUE;
+			break;
+	}
+	return 0;
+}
+
+int IsHex(char c) {
+	return IsDigit(c) || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+// same longest matches as the Decimal/Octal/Hexadecimal rules in sysy.l
+int ScanNumber() {
+	auto s = scan_pos, p = s + 1;
+	if (*s != '0')
+		p = SkipRun(p, DigitMask, IsDigit);
+	else if (scan_end - p >= 2 && (*p | 0x20) == 'x' && IsHex(p[1])) {
+		p += 2;
+		while (p < scan_end && IsHex(*p))
+			p++;
+	} else
+		while (p < scan_end && *p >= '0' && *p <= '7')
+			p++;
+	// strtol stops where the token ends, at the latest on the trailing 0s
+	yylval.int_val = strtol(s, nullptr, 0);
+	scan_pos = p;
+	return INT_CONST;
+}
+
+int ScanOp(char c, char next, sysy::OpType single, sysy::OpType twin, int single_tok, int twin_tok) {
+	if (next == '=') {
+		scan_pos += 2;
+		yylval.op_val = twin;
+		return twin_tok;
+	}
+	scan_pos++;
+	yylval.op_val = single;
+	return single_tok ? single_tok : c;
+}
+
+int ScanToken() {
+	SkipBlank();
+	if (scan_pos >= scan_end)
+		return 0;
+	char c = *scan_pos;
+	char next = scan_end - scan_pos >= 2 ? scan_pos[1] : 0;
+	if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') {
+		auto s = scan_pos;
+		scan_pos = SkipRun(s + 1, IdentMask, IsIdent);
+		int len = scan_pos - s;
+		int tok = Keyword(s, len);
+		if (tok)
+			return tok;
+		yylval.ident_val = symtab::InternIdent(s, len);
+		return IDENT;
+	}
+	if (IsDigit(c))
+		return ScanNumber();
+	switch (c) {
+		case '+': scan_pos++; yylval.op_val = sysy::OPADD; return ADDOP;
+		case '-': scan_pos++; yylval.op_val = sysy::OPSUB; return ADDOP;
+		case '*': scan_pos++; yylval.op_val = sysy::OPMUL; return MULOP;
+		case '/': scan_pos++; yylval.op_val = sysy::OPDIV; return MULOP;
+		case '%': scan_pos++; yylval.op_val = sysy::OPMOD; return MULOP;
+		case '<': return ScanOp(c, next, sysy::OPLT, sysy::OPLE, RELOP, RELOP);
+		case '>': return ScanOp(c, next, sysy::OPGT, sysy::OPGE, RELOP, RELOP);
+		case '=': return ScanOp(c, next, sysy::NOOP, sysy::OPEQ, 0, EQOP);
+		case '!': return ScanOp(c, next, sysy::NOOP, sysy::OPNE, 0, EQOP);
+	}
+	if ((c == '&' || c == '|') && next == c) {
+		scan_pos += 2;
+		return c == '&' ? ANDOP : OROP;
+	}
+	scan_pos++;
+	return c;
+}
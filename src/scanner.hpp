@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+
+// hand-written alternative to the flex scanner, producing the same tokens
+// whitespace, comments, identifiers and numbers are scanned 8 bytes at a time
+extern int use_hand_scanner;
+void ScanBuffer(const char *base, size_t size);
+int ScanToken();
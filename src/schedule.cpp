@@ -0,0 +1,124 @@
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include "riscv.hpp"
+#include "schedule.hpp"
+
+using namespace std;
+
+void ListSchedule(const vector<vector<pair<int, int> > > &deps, vector<int> &order) {
+	int n = deps.size();
+	vector<int> height(n, 1), npreds(n), ready(n), issued(n);
+	vector<vector<pair<int, int> > > succs(n);
+	for (int j = 0; j < n; j++)
+		for (auto &dep: deps[j]) {
+			succs[dep.first].push_back(make_pair(j, dep.second));
+			npreds[j]++;
+		}
+	for (int i = n - 1; i >= 0; i--)
+		for (auto &succ: succs[i])
+			height[i] = max(height[i], succ.second + height[succ.first]);
+	order.clear();
+	int cycle = 0;
+	for (int k = 0; k < n; k++) {
+		int best = -1;
+		for (int i = 0; i < n; i++) {
+			if (issued[i] || npreds[i])
+				continue;
+			if (best < 0)
+				best = i;
+			else {
+				int t1 = max(ready[i], cycle), t2 = max(ready[best], cycle);
+				if (t1 < t2 || (t1 == t2 && height[i] > height[best]))
+					best = i;
+			}
+		}
+		assert(best >= 0);
+		issued[best] = 1;
+		order.push_back(best);
+		cycle = max(ready[best], cycle) + 1;
+		for (auto &succ: succs[best]) {
+			npreds[succ.first]--;
+			ready[succ.first] = max(ready[succ.first], cycle - 1 + succ.second);
+		}
+	}
+}
+
+int GetLatency(riscv::Instr *instr) {
+	if (instr->op == riscv::LW)
+		return 3;
+	if (instr->op == riscv::MUL)
+		return 3;
+	if (instr->op == riscv::DIV || instr->op == riscv::REM)
+		return 11;
+	return 1;
+}
+
+int IsBoundary(riscv::Item *item) {
+	if (item->item_type != riscv::INSTR)
+		return 1;
+	auto instr = static_cast<riscv::Instr*>(item);
+	return instr->instr_type == riscv::LABELINSTR && instr->op != riscv::LA;
+}
+
+int MemConflict(riscv::Instr *instr1, riscv::Instr *instr2) {
+	int mem1 = instr1->op == riscv::LW || instr1->op == riscv::SW;
+	int mem2 = instr2->op == riscv::LW || instr2->op == riscv::SW;
+	if (!mem1 || !mem2 || (instr1->op == riscv::LW && instr2->op == riscv::LW))
+		return 0;
+	auto imm1 = static_cast<riscv::ImmInstr*>(instr1);
+	auto imm2 = static_cast<riscv::ImmInstr*>(instr2);
+	if (imm1->rs == riscv::SP && imm2->rs == riscv::SP && imm1->imm != imm2->imm)
+		return 0;
+	return 1;
+}
+
+void ScheduleSegment(vector<unique_ptr<riscv::Item> > &code, int begin, int end) {
+	int n = end - begin;
+	if (n <= 2)
+		return;
+	vector<riscv::Instr*> instrs;
+	for (int i = begin; i < end; i++)
+		instrs.push_back(static_cast<riscv::Instr*>(code[i].get()));
+	vector<vector<pair<int, int> > > deps(n);
+	for (int j = 0; j < n; j++) {
+		riscv::Reg uses_j[2];
+		int cnt_j = instrs[j]->Uses(uses_j);
+		riscv::Reg def_j = instrs[j]->Def();
+		for (int i = 0; i < j; i++) {
+			riscv::Reg uses_i[2];
+			int cnt_i = instrs[i]->Uses(uses_i);
+			riscv::Reg def_i = instrs[i]->Def();
+			int lat = -1;
+			for (int k = 0; k < cnt_j; k++)
+				if (def_i != riscv::NOREG && uses_j[k] == def_i)
+					lat = max(lat, GetLatency(instrs[i]));
+			for (int k = 0; k < cnt_i; k++)
+				if (def_j != riscv::NOREG && uses_i[k] == def_j)
+					lat = max(lat, 0);
+			if (def_i != riscv::NOREG && def_i == def_j)
+				lat = max(lat, 0);
+			if (MemConflict(instrs[i], instrs[j]))
+				lat = max(lat, instrs[i]->op == riscv::SW ? 1 : 0);
+			if (lat >= 0)
+				deps[j].push_back(make_pair(i, lat));
+		}
+	}
+	vector<int> order;
+	ListSchedule(deps, order);
+	vector<unique_ptr<riscv::Item> > items;
+	for (int i: order)
+		items.push_back(move(code[begin + i]));
+	for (int i = 0; i < n; i++)
+		code[begin + i] = move(items[i]);
+}
+
+void ScheduleCode(vector<unique_ptr<riscv::Item> > &code, int start) {
+	int begin = start;
+	for (int i = start; i <= code.size(); i++)
+		if (i == code.size() || IsBoundary(code[i].get())) {
+			ScheduleSegment(code, begin, i);
+			begin = i + 1;
+		}
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "riscv.hpp"
+
+// deps[j] holds (i, latency) pairs with i < j: j may issue no earlier than
+// latency cycles after i
+void ListSchedule(const std::vector<std::vector<std::pair<int, int> > > &deps,
+std::vector<int> &order);
+void ScheduleCode(std::vector<std::unique_ptr<riscv::Item> > &code, int start);
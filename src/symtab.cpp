@@ -1,3 +1,21 @@
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include "symtab.hpp"
 
-symtab::SymTabStack symtab_stack;
\ No newline at end of file
+// keys are views of the pooled strings, so a lookup straight from the
+// input buffer allocates nothing unless the name is new
+const std::string *symtab::InternIdent(const char *s, int len) {
+	// per thread, so that batch workers never share it
+	static thread_local std::unordered_map<std::string_view, std::unique_ptr<std::string> > ident_pool;
+	auto it = ident_pool.find(std::string_view(s, len));
+	if (it != ident_pool.end())
+		return it->second.get();
+	auto str = std::make_unique<std::string>(s, len);
+	auto ret = str.get();
+	ident_pool.emplace(std::string_view(*ret), move(str));
+	return ret;
+}
+
+thread_local symtab::SymTabStack symtab_stack;
@@ -4,7 +4,8 @@
 #include <memory>
 #include <string>
 #include <vector>
-#include <map>
+#include <unordered_map>
+#include <cstring>
 #include <cassert>
 #include "koopa.hpp"
 
@@ -29,13 +30,30 @@ class ConstSymb: public Symbol {
 		ConstSymb(int x): Symbol(CONSTSYMB), val(x) {}
 };
 
+// a const array also keeps its flattened contents in vals, indexed with the
+// suffix products in suf_mul
 class VarSymb: public Symbol {
 	public:
 		std::string name;
 		int is_param;
 		int depth;
+		std::vector<int> suf_mul, vals;
 		VarSymb(std::string s, int b, int d):
 			Symbol(VARSYMB), name(s), is_param(b), depth(d) {}
+		VarSymb(std::string s, int b, int d, std::vector<int> m, std::vector<int> v):
+			Symbol(VARSYMB), name(s), is_param(b), depth(d), suf_mul(m), vals(v) {}
+		int GetConst(const std::vector<int> &idx, int &val) const {
+			if (vals.empty() || idx.size() != depth)
+				return 0;
+			int pos = 0;
+			for (int i = 0; i < depth; i++) {
+				if (idx[i] < 0 || idx[i] * suf_mul[i + 1] >= suf_mul[i])
+					return 0;
+				pos += idx[i] * suf_mul[i + 1];
+			}
+			val = vals[pos];
+			return 1;
+		}
 };
 
 class FuncSymb: public Symbol {
@@ -45,69 +63,78 @@ class FuncSymb: public Symbol {
 			Symbol(FUNCSYMB), is_int(a) {}
 };
 
-class SymTab {
-	public:
-		std::map<std::string, std::unique_ptr<Symbol> > table;
-		int AddSymbol(std::string s, std::unique_ptr<Symbol> ptr) {
-			if (table.count(s))
-				assert(0);
-			table[s] = std::move(ptr);
-			return 1;
-		}
-		Symbol *GetSymbol(std::string s) {
-			if (!table.count(s))
-				return nullptr;
-			return table[s].get();
-		}
-};
+// identifiers live in a pool, so every occurrence of a name shares one
+// string and the symbol table can key on its address
+const std::string *InternIdent(const char *s, int len);
 
+// one hash table for all open scopes, keyed by interned name
+// every binding links to the one it shadows, and each scope keeps a log of
+// the bindings it made so that pop() restores the outer ones
 class SymTabStack {
 	public:
-		std::vector<std::unique_ptr<SymTab> > symtabs;
+		struct Binding {
+			std::unique_ptr<Symbol> symb;
+			int scope;
+			Binding *shadowed;
+		};
+		std::unordered_map<const std::string*, Binding*> table;
+		std::vector<std::vector<std::pair<const std::string*, std::unique_ptr<Binding> > > > undo_logs;
 		int total;
-		SymTabStack(): symtabs(), total(0) {
+		SymTabStack() {
+			Reset();
+		}
+		// back to a single scope holding the runtime library
+		void Reset() {
+			table.clear();
+			undo_logs.clear();
+			total = 0;
 			push();
-			const auto &ptr = symtabs.back();
-			ptr->AddSymbol("getint", std::make_unique<FuncSymb>(1));
-			ptr->AddSymbol("getch", std::make_unique<FuncSymb>(1));
-			ptr->AddSymbol("getarray", std::make_unique<FuncSymb>(1));
-			ptr->AddSymbol("putint", std::make_unique<FuncSymb>(0));
-			ptr->AddSymbol("putch", std::make_unique<FuncSymb>(0));
-			ptr->AddSymbol("putarray", std::make_unique<FuncSymb>(0));
-			ptr->AddSymbol("starttime", std::make_unique<FuncSymb>(0));
-			ptr->AddSymbol("stoptime", std::make_unique<FuncSymb>(0));
+			for (auto name: {"getint", "getch", "getarray"})
+				AddSymbol(*InternIdent(name, strlen(name)), std::make_unique<FuncSymb>(1));
+			for (auto name: {"putint", "putch", "putarray", "starttime", "stoptime"})
+				AddSymbol(*InternIdent(name, strlen(name)), std::make_unique<FuncSymb>(0));
 		}
 		void push() {
-			symtabs.push_back(std::make_unique<SymTab>());
+			undo_logs.emplace_back();
 			total++;
 		}
-		std::unique_ptr<SymTab> pop() {
+		void pop() {
 			total++;
-			auto ptr = std::move(symtabs.back());
-			symtabs.pop_back();
-			return ptr;
+			auto &log = undo_logs.back();
+			for (auto it = log.rbegin(); it != log.rend(); it++) {
+				auto shadowed = it->second->shadowed;
+				if (shadowed)
+					table[it->first] = shadowed;
+				else
+					table.erase(it->first);
+			}
+			undo_logs.pop_back();
 		}
 		int GetTotal() {
 			return total;
 		}
-		SymTab *GetTop() {
-			return symtabs.back().get();
-		}
-		int AddSymbol(std::string s, std::unique_ptr<Symbol> ptr) {
-			auto top_symtab = GetTop();
-			return top_symtab->AddSymbol(s, move(ptr));
+		// s must be an interned identifier
+		int AddSymbol(const std::string &s, std::unique_ptr<Symbol> ptr) {
+			int scope = undo_logs.size();
+			auto &slot = table[&s];
+			if (slot && slot->scope == scope)
+				assert(0);
+			auto binding = std::make_unique<Binding>();
+			binding->symb = std::move(ptr);
+			binding->scope = scope;
+			binding->shadowed = slot;
+			slot = binding.get();
+			undo_logs.back().emplace_back(&s, std::move(binding));
+			return 1;
 		}
-		Symbol *GetSymbol(std::string s) {
-			for (auto it = symtabs.rbegin(); it != symtabs.rend(); it++) {
-				auto symb = (*it)->GetSymbol(s);
-				if (symb)
-					return symb;
-			}
-			assert(0);
-			return nullptr;
+		Symbol *GetSymbol(const std::string &s) {
+			auto it = table.find(&s);
+			if (it == table.end())
+				assert(0);
+			return it->second->symb.get();
 		}
 };
 
 }
 
-extern symtab::SymTabStack symtab_stack;
\ No newline at end of file
+extern thread_local symtab::SymTabStack symtab_stack;
\ No newline at end of file
@@ -1,10 +1,31 @@
 #include <memory>
 #include <string>
 #include <iostream>
+#include <climits>
 #include "sysy.hpp"
 
 using namespace sysy;
 
+int sysy::FoldOp(OpType op, int a, int b, int &result) {
+	unsigned ua = a, ub = b;
+	if (op == OPADD) result = ua + ub;
+	else if (op == OPSUB) result = ua - ub;
+	else if (op == OPMUL) result = ua * ub;
+	else if (op == OPDIV || op == OPMOD) {
+		if (b == 0 || (a == INT_MIN && b == -1))
+			return 0;
+		result = op == OPDIV ? a / b : a % b;
+	} else if (op == OPLT) result = a < b;
+	else if (op == OPGT) result = a > b;
+	else if (op == OPLE) result = a <= b;
+	else if (op == OPGE) result = a >= b;
+	else if (op == OPEQ) result = a == b;
+	else if (op == OPNE) result = a != b;
+	else
+		return 0;
+	return 1;
+}
+
 BracketExp::BracketExp(Base *p): PrimaryExp(BRACKETEXP), exp(static_cast<Exp*>(p)){}
 void BracketExp::Dump() const {
 	std::cout << "PrimaryExp { ( ";
@@ -16,8 +37,30 @@ int BracketExp::Eval() const {
 	return exp->Eval();
 }
 
+int BracketExp::Literal(int &val) const {
+	return exp->Literal(val);
+}
+
+int LValExp::Eval() const {
+	auto symb = symtab_stack.GetSymbol(lval->ident);
+	assert(symb);
+	if (symb->symb_type == symtab::VARSYMB) {
+		auto var_symb = static_cast<symtab::VarSymb*>(symb);
+		std::vector<int> idx;
+		for (const auto &exp: lval->dims)
+			idx.push_back(exp->Eval());
+		int val = 0;
+		int is_const = var_symb->GetConst(idx, val);
+		assert(is_const);
+		return val;
+	}
+	assert(symb->symb_type == symtab::CONSTSYMB);
+	auto new_symb = static_cast<symtab::ConstSymb*>(symb);
+	return new_symb->val;
+}
+
 
-FuncUnaryExp::FuncUnaryExp(std::string s, void *p):
+FuncUnaryExp::FuncUnaryExp(const std::string &s, void *p):
 UnaryExp(FUNCUNARYEXP), ident(s),
 params(move(*std::unique_ptr<std::vector<std::unique_ptr<Exp> > >(
 static_cast<std::vector<std::unique_ptr<Exp> >*>(p)))) {}
@@ -37,7 +80,7 @@ int FuncUnaryExp::Eval() const {
 }
 
 
-LVal::LVal(std::string s, void *p): ident(s),
+LVal::LVal(const std::string &s, void *p): ident(s),
 	dims(move(*std::unique_ptr<std::vector<std::unique_ptr<Exp> > >
 	(static_cast<std::vector<std::unique_ptr<Exp> >*>(p)))) {}
 void LVal::Dump() const {
@@ -19,13 +19,34 @@ class Base {
 
 class Exp;
 
+// operators, handed over by the lexer as enum values
+enum OpType {
+	NOOP,
+	OPADD, OPSUB, OPMUL, OPDIV, OPMOD,
+	OPLT, OPGT, OPLE, OPGE, OPEQ, OPNE,
+	OPNOT
+};
+
+inline const char *OpName(OpType op) {
+	static const char *names[] = {
+		"",
+		"+", "-", "*", "/", "%",
+		"<", ">", "<=", ">=", "==", "!=",
+		"!"};
+	return names[op];
+}
+
+// folds a binary operator on two literals; division by 0 and INT_MIN / -1
+// are left to run time
+int FoldOp(OpType op, int a, int b, int &result);
+
 
 // LVal          ::= IDENT;
 class LVal: public Base {
 	public:
-		std::string ident;
+		const std::string &ident;
 		std::vector<std::unique_ptr<Exp> > dims;
-		LVal(std::string s, void *p);
+		LVal(const std::string &s, void *p);
 		virtual void Dump() const override;
 };
 
@@ -44,6 +65,8 @@ class PrimaryExp: public Base {
 		virtual ~PrimaryExp() override = default;
 		virtual void Dump() const override = 0;
 		virtual int Eval() const = 0;
+		// value of a subtree built only from literals, set up while parsing
+		virtual int Literal(int &val) const = 0;
 };
 
 class BracketExp: public PrimaryExp {
@@ -52,6 +75,7 @@ class BracketExp: public PrimaryExp {
 		BracketExp(Base *p);
 		virtual void Dump() const override;
 		virtual int Eval() const override;
+		virtual int Literal(int &val) const override;
 };
 
 class LValExp: public PrimaryExp {
@@ -64,11 +88,9 @@ class LValExp: public PrimaryExp {
 			lval->Dump();
 			std::cout << " }";
 		}
-		virtual int Eval() const override {
-			auto symb = symtab_stack.GetSymbol(lval->ident);
-			assert(symb && symb->symb_type == symtab::CONSTSYMB);
-			auto new_symb = static_cast<symtab::ConstSymb*>(symb);
-			return new_symb->val;
+		virtual int Eval() const override;
+		virtual int Literal(int &val) const override {
+			return 0;
 		}
 };
 
@@ -82,6 +104,10 @@ class NumberExp: public PrimaryExp {
 		virtual int Eval() const override {
 			return num;
 		}
+		virtual int Literal(int &val) const override {
+			val = num;
+			return 1;
+		}
 };
 
 
@@ -99,6 +125,7 @@ class UnaryExp: public Base {
 		virtual ~UnaryExp() override = default;
 		virtual void Dump() const override = 0;
 		virtual int Eval() const = 0;
+		virtual int Literal(int &val) const = 0;
 };
 
 class PrimUnaryExp: public UnaryExp {
@@ -114,67 +141,99 @@ class PrimUnaryExp: public UnaryExp {
 		virtual int Eval() const override {
 			return prim_exp->Eval();
 		}
+		virtual int Literal(int &val) const override {
+			return prim_exp->Literal(val);
+		}
 };
 
 class OpUnaryExp: public UnaryExp {
 	public:
-		std::string op;
+		OpType op;
 		std::unique_ptr<UnaryExp> exp;
-		OpUnaryExp(std::string s, Base *p): UnaryExp(OPUNARYEXP),
+		OpUnaryExp(OpType s, Base *p): UnaryExp(OPUNARYEXP),
 			op(s), exp(static_cast<UnaryExp*>(p)) {}
 		virtual void Dump() const override {
-			std::cout << "UnaryExp { " << op << " ";
+			std::cout << "UnaryExp { " << OpName(op) << " ";
 			exp->Dump();
 			std::cout << " }";
 		}
 		virtual int Eval() const override {
 			int val = exp->Eval();
-			if (op == "+")
+			if (op == OPADD)
 				return val;
-			else if (op == "-")
+			else if (op == OPSUB)
 				return -val;
 			return !val;
 		}
+		virtual int Literal(int &val) const override {
+			if (!exp->Literal(val))
+				return 0;
+			if (op == OPSUB)
+				val = -(unsigned)val;
+			else if (op == OPNOT)
+				val = !val;
+			return 1;
+		}
 };
 
 class FuncUnaryExp: public UnaryExp {
 	public:
-		std::string ident;
+		const std::string &ident;
 		std::vector<std::unique_ptr<Exp> > params;
-		FuncUnaryExp(std::string s, void *p);
+		FuncUnaryExp(const std::string &s, void *p);
 		virtual void Dump() const override;
 		virtual int Eval() const override;
+		virtual int Literal(int &val) const override {
+			return 0;
+		}
 };
 
 
 // MulExp      ::= UnaryExp | MulExp ("*" | "/" | "%") UnaryExp;
+// the left-recursive chains below are kept flat: ops[i] joins operand i
+// and operand i + 1
 class MulExp: public Base {
 	public:
-		std::unique_ptr<MulExp> mul_exp;
-		std::string op;
-		std::unique_ptr<UnaryExp> unary_exp;
-		MulExp(Base *p, std::string s, Base *q): mul_exp(static_cast<MulExp*>(p)),
-			op(s), unary_exp(static_cast<UnaryExp*>(q)) {}
+		std::vector<std::unique_ptr<UnaryExp> > unary_exps;
+		std::vector<OpType> ops;
+		MulExp(Base *p) {
+			unary_exps.emplace_back(static_cast<UnaryExp*>(p));
+		}
+		void Append(OpType s, Base *q) {
+			ops.push_back(s);
+			unary_exps.emplace_back(static_cast<UnaryExp*>(q));
+		}
 		virtual void Dump() const override{
 			std::cout << "MulExp { ";
-			if (mul_exp) {
-				mul_exp->Dump();
-				std::cout << " " + op + " ";
+			for (int i = 0; i < unary_exps.size(); i++) {
+				if (i)
+					std::cout << " " << OpName(ops[i - 1]) << " ";
+				unary_exps[i]->Dump();
 			}
-			unary_exp->Dump();
 			std::cout << " }";
 		}
 		int Eval() const {
-			int unary_val = unary_exp->Eval();
-			if (mul_exp) {
-				int mul_val = mul_exp->Eval();
-				if (op == "*")
-					return mul_val*unary_val;
-				else if (op == "/")
-					return mul_val/unary_val;
-				return mul_val%unary_val;
+			int val = unary_exps[0]->Eval();
+			for (int i = 1; i < unary_exps.size(); i++) {
+				int unary_val = unary_exps[i]->Eval();
+				if (ops[i - 1] == OPMUL)
+					val = val*unary_val;
+				else if (ops[i - 1] == OPDIV)
+					val = val/unary_val;
+				else
+					val = val%unary_val;
 			}
-			return unary_val;
+			return val;
+		}
+		int Literal(int &val) const {
+			if (!unary_exps[0]->Literal(val))
+				return 0;
+			for (int i = 1; i < unary_exps.size(); i++) {
+				int unary_val;
+				if (!unary_exps[i]->Literal(unary_val) || !FoldOp(ops[i - 1], val, unary_val, val))
+					return 0;
+			}
+			return 1;
 		}
 };
 
@@ -182,62 +241,92 @@ class MulExp: public Base {
 // AddExp      ::= MulExp | AddExp ("+" | "-") MulExp;
 class AddExp: public Base {
 	public:
-		std::unique_ptr<AddExp> add_exp;
-		std::string op;
-		std::unique_ptr<MulExp> mul_exp;
-		AddExp(Base *p, std::string s, Base *q): add_exp(static_cast<AddExp*>(p)),
-			op(s), mul_exp(static_cast<MulExp*>(q)) {}
+		std::vector<std::unique_ptr<MulExp> > mul_exps;
+		std::vector<OpType> ops;
+		AddExp(Base *p) {
+			mul_exps.emplace_back(static_cast<MulExp*>(p));
+		}
+		void Append(OpType s, Base *q) {
+			ops.push_back(s);
+			mul_exps.emplace_back(static_cast<MulExp*>(q));
+		}
 		virtual void Dump() const override {
 			std::cout << "AddExp { ";
-			if (add_exp) {
-				add_exp->Dump();
-				std::cout << " " + op + " ";
+			for (int i = 0; i < mul_exps.size(); i++) {
+				if (i)
+					std::cout << " " << OpName(ops[i - 1]) << " ";
+				mul_exps[i]->Dump();
 			}
-			mul_exp->Dump();
 			std::cout << " }";
 		}
 		int Eval() const {
-			int mul_val = mul_exp->Eval();
-			if (add_exp) {
-				int add_val = add_exp->Eval();
-				if (op == "+")
-					return add_val + mul_val;
-				return add_val - mul_val;
+			int val = mul_exps[0]->Eval();
+			for (int i = 1; i < mul_exps.size(); i++) {
+				int mul_val = mul_exps[i]->Eval();
+				if (ops[i - 1] == OPADD)
+					val = val + mul_val;
+				else
+					val = val - mul_val;
 			}
-			return mul_val;
+			return val;
+		}
+		int Literal(int &val) const {
+			if (!mul_exps[0]->Literal(val))
+				return 0;
+			for (int i = 1; i < mul_exps.size(); i++) {
+				int mul_val;
+				if (!mul_exps[i]->Literal(mul_val) || !FoldOp(ops[i - 1], val, mul_val, val))
+					return 0;
+			}
+			return 1;
 		}
 };
 
 // RelExp      ::= AddExp | RelExp ("<" | ">" | "<=" | ">=") AddExp;
 class RelExp: public Base {
 	public:
-		std::unique_ptr<RelExp> rel_exp;
-		std::string op;
-		std::unique_ptr<AddExp> add_exp;
-		RelExp(Base *p, std::string s, Base *q): rel_exp(static_cast<RelExp*>(p)),
-			op(s), add_exp(static_cast<AddExp*>(q)) {}
+		std::vector<std::unique_ptr<AddExp> > add_exps;
+		std::vector<OpType> ops;
+		RelExp(Base *p) {
+			add_exps.emplace_back(static_cast<AddExp*>(p));
+		}
+		void Append(OpType s, Base *q) {
+			ops.push_back(s);
+			add_exps.emplace_back(static_cast<AddExp*>(q));
+		}
 		virtual void Dump() const override {
 			std::cout << "RelExp { ";
-			if (rel_exp) {
-				rel_exp->Dump();
-				std::cout << " " + op + " ";
+			for (int i = 0; i < add_exps.size(); i++) {
+				if (i)
+					std::cout << " " << OpName(ops[i - 1]) << " ";
+				add_exps[i]->Dump();
 			}
-			add_exp->Dump();
 			std::cout << " }";
 		}
 		int Eval() const {
-			int add_val = add_exp->Eval();
-			if (rel_exp) {
-				int rel_val = rel_exp->Eval();
-				if (op == "<")
-					return rel_val < add_val;
-				else if (op == ">")
-					return rel_val > add_val;
-				else if (op == "<=")
-					return rel_val <= add_val;
-				return rel_val >= add_val;
+			int val = add_exps[0]->Eval();
+			for (int i = 1; i < add_exps.size(); i++) {
+				int add_val = add_exps[i]->Eval();
+				if (ops[i - 1] == OPLT)
+					val = val < add_val;
+				else if (ops[i - 1] == OPGT)
+					val = val > add_val;
+				else if (ops[i - 1] == OPLE)
+					val = val <= add_val;
+				else
+					val = val >= add_val;
 			}
-			return add_val;
+			return val;
+		}
+		int Literal(int &val) const {
+			if (!add_exps[0]->Literal(val))
+				return 0;
+			for (int i = 1; i < add_exps.size(); i++) {
+				int add_val;
+				if (!add_exps[i]->Literal(add_val) || !FoldOp(ops[i - 1], val, add_val, val))
+					return 0;
+			}
+			return 1;
 		}
 };
 
@@ -245,29 +334,44 @@ class RelExp: public Base {
 // EqExp       ::= RelExp | EqExp ("==" | "!=") RelExp;
 class EqExp: public Base {
 	public:
-		std::unique_ptr<EqExp> eq_exp;
-		std::string op;
-		std::unique_ptr<RelExp> rel_exp;
-		EqExp(Base *p, std::string s, Base *q): eq_exp(static_cast<EqExp*>(p)),
-			op(s), rel_exp(static_cast<RelExp*>(q)) {}
+		std::vector<std::unique_ptr<RelExp> > rel_exps;
+		std::vector<OpType> ops;
+		EqExp(Base *p) {
+			rel_exps.emplace_back(static_cast<RelExp*>(p));
+		}
+		void Append(OpType s, Base *q) {
+			ops.push_back(s);
+			rel_exps.emplace_back(static_cast<RelExp*>(q));
+		}
 		virtual void Dump() const override {
 			std::cout << "EqExp { ";
-			if (eq_exp) {
-				eq_exp->Dump();
-				std::cout << " " + op + " ";
+			for (int i = 0; i < rel_exps.size(); i++) {
+				if (i)
+					std::cout << " " << OpName(ops[i - 1]) << " ";
+				rel_exps[i]->Dump();
 			}
-			rel_exp->Dump();
 			std::cout << " }";
 		}
 		int Eval() const {
-			int rel_val = rel_exp->Eval();
-			if (eq_exp) {
-				int eq_val = eq_exp->Eval();
-				if (op == "==")
-					return eq_val == rel_val;
-				return eq_val != rel_val;
+			int val = rel_exps[0]->Eval();
+			for (int i = 1; i < rel_exps.size(); i++) {
+				int rel_val = rel_exps[i]->Eval();
+				if (ops[i - 1] == OPEQ)
+					val = val == rel_val;
+				else
+					val = val != rel_val;
 			}
-			return rel_val;
+			return val;
+		}
+		int Literal(int &val) const {
+			if (!rel_exps[0]->Literal(val))
+				return 0;
+			for (int i = 1; i < rel_exps.size(); i++) {
+				int rel_val;
+				if (!rel_exps[i]->Literal(rel_val) || !FoldOp(ops[i - 1], val, rel_val, val))
+					return 0;
+			}
+			return 1;
 		}
 };
 
@@ -275,26 +379,40 @@ class EqExp: public Base {
 // LAndExp     ::= EqExp | LAndExp "&&" EqExp;
 class LAndExp: public Base {
 	public:
-		std::unique_ptr<LAndExp> land_exp;
-		std::unique_ptr<EqExp> eq_exp;
-		LAndExp(Base *p, Base *q): land_exp(static_cast<LAndExp*>(p)),
-			eq_exp(static_cast<EqExp*>(q)) {}
+		std::vector<std::unique_ptr<EqExp> > eq_exps;
+		LAndExp(Base *p) {
+			eq_exps.emplace_back(static_cast<EqExp*>(p));
+		}
+		void Append(Base *q) {
+			eq_exps.emplace_back(static_cast<EqExp*>(q));
+		}
 		virtual void Dump() const override {
 			std::cout << "LAndExp { ";
-			if (land_exp) {
-				land_exp->Dump();
-				std::cout << " && ";
+			for (int i = 0; i < eq_exps.size(); i++) {
+				if (i)
+					std::cout << " && ";
+				eq_exps[i]->Dump();
 			}
-			eq_exp->Dump();
 			std::cout << " }";
 		}
 		int Eval() const {
-			int eq_val = eq_exp->Eval();
-			if (land_exp) {
-				int land_val = land_exp->Eval();
-				return land_val && eq_val;
+			int val = eq_exps[0]->Eval();
+			for (int i = 1; i < eq_exps.size(); i++) {
+				int eq_val = eq_exps[i]->Eval();
+				val = val && eq_val;
+			}
+			return val;
+		}
+		int Literal(int &val) const {
+			if (!eq_exps[0]->Literal(val))
+				return 0;
+			for (int i = 1; i < eq_exps.size(); i++) {
+				int eq_val;
+				if (!eq_exps[i]->Literal(eq_val))
+					return 0;
+				val = val && eq_val;
 			}
-			return eq_val;
+			return 1;
 		}
 };
 
@@ -302,42 +420,73 @@ class LAndExp: public Base {
 // LOrExp      ::= LAndExp | LOrExp "||" LAndExp;
 class LOrExp: public Base {
 	public:
-		std::unique_ptr<LOrExp> lor_exp;
-		std::unique_ptr<LAndExp> land_exp;
-		LOrExp(Base *p, Base *q): lor_exp(static_cast<LOrExp*>(p)),
-			land_exp(static_cast<LAndExp*>(q)) {}
+		std::vector<std::unique_ptr<LAndExp> > land_exps;
+		LOrExp(Base *p) {
+			land_exps.emplace_back(static_cast<LAndExp*>(p));
+		}
+		void Append(Base *q) {
+			land_exps.emplace_back(static_cast<LAndExp*>(q));
+		}
 		virtual void Dump() const override {
 			std::cout << "LOrExp { ";
-			if (lor_exp) {
-				lor_exp->Dump();
-				std::cout << " || ";
+			for (int i = 0; i < land_exps.size(); i++) {
+				if (i)
+					std::cout << " || ";
+				land_exps[i]->Dump();
 			}
-			land_exp->Dump();
 			std::cout << " }";
 		}
 		int Eval() const {
-			int land_val = land_exp->Eval();
-			if (lor_exp) {
-				int lor_val = lor_exp->Eval();
-				return lor_val || land_val;
+			int val = land_exps[0]->Eval();
+			for (int i = 1; i < land_exps.size(); i++) {
+				int land_val = land_exps[i]->Eval();
+				val = val || land_val;
 			}
-			return land_val;
+			return val;
+		}
+		int Literal(int &val) const {
+			if (!land_exps[0]->Literal(val))
+				return 0;
+			for (int i = 1; i < land_exps.size(); i++) {
+				int land_val;
+				if (!land_exps[i]->Literal(land_val))
+					return 0;
+				val = val || land_val;
+			}
+			return 1;
 		}
 };
 
 
 // Exp         ::= LOrExp;
+// an expression made only of literals is folded when it is built, nested
+// Exps first; any other Eval result is cached, since an expression is only
+// ever evaluated in one scope
 class Exp: public Base {
 	public:
 		std::unique_ptr<LOrExp> exp;
-		Exp(Base *p): exp(static_cast<LOrExp*>(p)) {}
+		int is_literal, literal;
+		mutable int eval_done, eval_val;
+		Exp(Base *p): exp(static_cast<LOrExp*>(p)), literal(0), eval_done(0), eval_val(0) {
+			is_literal = exp->Literal(literal);
+		}
 		virtual void Dump() const override {
 			std::cout << "Exp { ";
 			exp->Dump();
 			std::cout << " }";
 		}
 		int Eval() const {
-			return exp->Eval();
+			if (is_literal)
+				return literal;
+			if (!eval_done) {
+				eval_val = exp->Eval();
+				eval_done = 1;
+			}
+			return eval_val;
+		}
+		int Literal(int &val) const {
+			val = literal;
+			return is_literal;
 		}
 };
 
@@ -388,10 +537,10 @@ class ListInitVal: public InitVal {
 // ConstDef      ::= IDENT ["[" ConstExp "]"] "=" ConstInitVal;
 class ConstDef: public Base {
 	public:
-		std::string ident;
+		const std::string &ident;
 		std::vector<std::unique_ptr<Exp> > dims;
 		std::unique_ptr<InitVal> init_val;
-		ConstDef(std::string s, void *v, Base *p): ident(s),
+		ConstDef(const std::string &s, void *v, Base *p): ident(s),
 			dims(move(*std::unique_ptr<std::vector<std::unique_ptr<Exp> > >
 			(static_cast<std::vector<std::unique_ptr<Exp> >*>(v)))),
 			init_val(static_cast<InitVal*>(p)) {}
@@ -413,10 +562,10 @@ class ConstDef: public Base {
 //                 | IDENT {"[" ConstExp "]"} "=" InitVal;
 class VarDef: public Base {
 	public:
-		std::string ident;
+		const std::string &ident;
 		std::vector<std::unique_ptr<Exp> > dims;
 		std::unique_ptr<InitVal> init_val;
-		VarDef(std::string s, void *v, Base *p): ident(s),
+		VarDef(const std::string &s, void *v, Base *p): ident(s),
 			dims(move(*std::unique_ptr<std::vector<std::unique_ptr<Exp> > >
 			(static_cast<std::vector<std::unique_ptr<Exp> >*>(v)))),
 			init_val(static_cast<InitVal*>(p)) {}
@@ -780,9 +929,9 @@ class BlockStmt: public NonIfStmt {
 // FuncFParam ::= BType IDENT ["[" "]" {"[" ConstExp "]"}];
 class FuncFParam: public Base {
 	public:
-		std::string ident;
+		const std::string &ident;
 		std::vector<std::unique_ptr<Exp> > dims;
-		FuncFParam(std::string s, void *p): ident(s),
+		FuncFParam(const std::string &s, void *p): ident(s),
 			dims(move(*std::unique_ptr<std::vector<std::unique_ptr<Exp> > >
 			(static_cast<std::vector<std::unique_ptr<Exp> >*>(p)))) {}
 		virtual void Dump() const override {
@@ -802,10 +951,10 @@ class FuncFParam: public Base {
 class FuncDef: public Base {
 	public:
 		std::string func_type;
-		std::string ident;
+		const std::string &ident;
 		std::vector<std::unique_ptr<FuncFParam> > params;
 		std::unique_ptr<Block> block;
-		FuncDef(std::string f, std::string s, void *l, Base *q):
+		FuncDef(std::string f, const std::string &s, void *l, Base *q):
 			func_type(f), ident(s),
 			params(move(*std::unique_ptr<std::vector<std::unique_ptr<FuncFParam> > >(
 			static_cast<std::vector<std::unique_ptr<FuncFParam> >*>(l)))),
@@ -31,16 +31,19 @@ void yyerror(std::unique_ptr<CompUnit> &ast, const char *s);
 // 至于为什么要用字符串指针而不直接用 string 或者 unique_ptr<string>?
 // 请自行 STFW 在 union 里写一个带析构函数的类会出现什么情况
 %union {
-	std::string *str_val;
+	const std::string *ident_val;
+	sysy::OpType op_val;
 	int int_val;
 	sysy::Base *ast_val;
 	void *void_val;
 }
 
 // lexer 返回的所有 token 种类的声明
-// 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 str_val 和 int_val
+// 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 ident_val 和 int_val
+// IDENT 的值是字符串池里的字符串, 不需要 delete, AST 里直接引用它; 运算符的值是 OpType
 %token INT RETURN ANDOP OROP CONST IF ELSE WHILE BREAK CONTINUE VOID
-%token <str_val> IDENT RELOP EQOP MULOP ADDOP
+%token <ident_val> IDENT
+%token <op_val> RELOP EQOP MULOP ADDOP
 %token <int_val> INT_CONST
 
 // 非终结符的类型定义
@@ -101,14 +104,14 @@ CompList
 
 FuncFParam
 	: INT IDENT {
-		auto ast = new FuncFParam(*unique_ptr<string>($2),
+		auto ast = new FuncFParam(*$2,
 			new vector<unique_ptr<Exp> >());
 		$$ = ast;
 	}
 	| INT IDENT '[' ']' DimList {
 		auto list = static_cast<vector<unique_ptr<Exp> >*>($5);
 		list->emplace(list->begin(), nullptr);
-		auto ast = new FuncFParam(*unique_ptr<string>($2), list);
+		auto ast = new FuncFParam(*$2, list);
 		$$ = ast;
 	};
 
@@ -144,11 +147,11 @@ FuncRParamList
 
 FuncDef
 	: INT IDENT '(' FuncFParamList ')' Block {
-		auto ast = new FuncDef("int", *unique_ptr<string>($2), $4, $6);
+		auto ast = new FuncDef("int", *$2, $4, $6);
 		$$ = ast;
 	}
 	| VOID IDENT '(' FuncFParamList ')' Block {
-		auto ast = new FuncDef("void", *unique_ptr<string>($2), $4, $6);
+		auto ast = new FuncDef("void", *$2, $4, $6);
 		$$ = ast;
 	};
 
@@ -252,75 +255,81 @@ UnaryExp
 		$$ = ast;
 	}
 	| ADDOP UnaryExp {
-		auto ast = new OpUnaryExp(*unique_ptr<string>($1), $2);
+		auto ast = new OpUnaryExp($1, $2);
 		$$ = ast;
 	}
 	| '!' UnaryExp {
-		auto ast = new OpUnaryExp("!", $2);
+		auto ast = new OpUnaryExp(OPNOT, $2);
 		$$ = ast;
 	}
 	| IDENT '(' FuncRParamList ')' {
-		auto ast = new FuncUnaryExp(*unique_ptr<string>($1), $3);
+		auto ast = new FuncUnaryExp(*$1, $3);
 		$$ = ast;
 	};
 
 MulExp
 	: UnaryExp {
-		auto ast = new MulExp(nullptr, "", $1);
+		auto ast = new MulExp($1);
 		$$ = ast;
 	}
 	| MulExp MULOP UnaryExp {
-		auto ast = new MulExp($1, *unique_ptr<string>($2), $3);
+		auto ast = static_cast<MulExp*>($1);
+		ast->Append($2, $3);
 		$$ = ast;
 	};
 
 AddExp
 	: MulExp {
-		auto ast = new AddExp(nullptr, "", $1);
+		auto ast = new AddExp($1);
 		$$ = ast;
 	}
 	| AddExp ADDOP MulExp {
-		auto ast = new AddExp($1, *unique_ptr<string>($2), $3);
+		auto ast = static_cast<AddExp*>($1);
+		ast->Append($2, $3);
 		$$ = ast;
 	};
 
 RelExp
 	: AddExp {
-		auto ast = new RelExp(nullptr, "", $1);
+		auto ast = new RelExp($1);
 		$$ = ast;
 	}
 	| RelExp RELOP AddExp {
-		auto ast = new RelExp($1, *unique_ptr<string>($2), $3);
+		auto ast = static_cast<RelExp*>($1);
+		ast->Append($2, $3);
 		$$ = ast;
 	};
 
 EqExp
 	: RelExp {
-		auto ast = new EqExp(nullptr, "", $1);
+		auto ast = new EqExp($1);
 		$$ = ast;
 	}
 	| EqExp EQOP RelExp {
-		auto ast = new EqExp($1, *unique_ptr<string>($2), $3);
+		auto ast = static_cast<EqExp*>($1);
+		ast->Append($2, $3);
 		$$ = ast;
 	}
 
 LAndExp
 	: EqExp {
-		auto ast = new LAndExp(nullptr, $1);
+		auto ast = new LAndExp($1);
 		$$ = ast;
 	}
 	| LAndExp ANDOP EqExp {
-		auto ast = new LAndExp($1, $3);
+		auto ast = static_cast<LAndExp*>($1);
+		ast->Append($3);
 		$$ = ast;
 	};
 
 LOrExp
 	: LAndExp {
-		auto ast = new LOrExp(nullptr, $1);
+		auto ast = new LOrExp($1);
 		$$ = ast;
 	}
 	| LOrExp OROP LAndExp {
-		auto ast = new LOrExp($1, $3);
+		auto ast = static_cast<LOrExp*>($1);
+		ast->Append($3);
 		$$ = ast;
 	};
 
@@ -337,13 +346,13 @@ DimList
 
 LVal
 	: IDENT DimList {
-		auto ast = new LVal(*unique_ptr<string>($1), $2);
+		auto ast = new LVal(*$1, $2);
 		$$ = ast;
 	};
 
 ConstDef
 	: IDENT DimList '=' InitVal {
-		auto ast = new ConstDef(*unique_ptr<string>($1), $2, $4);
+		auto ast = new ConstDef(*$1, $2, $4);
 		$$ = ast;
 	};
 
@@ -422,11 +431,11 @@ InitVal
 
 VarDef
 	: IDENT DimList {
-		auto ast = new VarDef(*unique_ptr<string>($1), $2, nullptr);
+		auto ast = new VarDef(*$1, $2, nullptr);
 		$$ = ast;
 	}
 	| IDENT DimList '=' InitVal {
-		auto ast = new VarDef(*unique_ptr<string>($1), $2, $4);
+		auto ast = new VarDef(*$1, $2, $4);
 		$$ = ast;
 	};
 
@@ -452,6 +461,10 @@ VarDecl
 
 // 定义错误处理函数, 其中第二个参数是错误信息
 // parser 如果发生错误 (例如输入的程序出现了语法错误), 就会调用这个函数
+// 本次解析的错误信息也记在 parse_error 里, 供 -server 模式返回给客户端
+string parse_error;
+
 void yyerror(unique_ptr<CompUnit> &ast, const char *s) {
 	cerr << "error: " << s << endl;
+	parse_error += string("error: ") + s + "\n";
 }
@@ -4,6 +4,7 @@
 #include <cassert>
 #include <string>
 #include <map>
+#include <climits>
 #include "sysy.hpp"
 #include "koopa.hpp"
 #include "types.hpp"
@@ -12,11 +13,14 @@
 
 using namespace std;
 
-int temp_var_counter = 0;
-int block_counter = 0;
-string next_block_symbol;
-vector<string> while_begin_stack, while_end_stack;
-string cur_func_type;
+// thread_local for batch mode, reset by GetCompUnit
+thread_local int temp_var_counter = 0;
+thread_local int block_counter = 0;
+thread_local string next_block_symbol;
+thread_local vector<string> while_begin_stack, while_end_stack;
+thread_local string cur_func_type;
+// local const arrays, emitted once as read-only globals
+thread_local vector<unique_ptr<koopa::GlobalSymbolDef> > hoisted_symbs;
 
 unique_ptr<koopa::Value> LoadSymb(string symb,
 vector<unique_ptr<koopa::Statement> > &stmts) {
@@ -56,8 +60,38 @@ unique_ptr<koopa::Statement> end_stmt) {
 }
 
 
+// folds op on two integers; division by 0 and INT_MIN / -1 are left to run time
+int FoldBinOp(string op, int a, int b, int &result) {
+	unsigned ua = a, ub = b;
+	if (op == "add") result = ua + ub;
+	else if (op == "sub") result = ua - ub;
+	else if (op == "mul") result = ua * ub;
+	else if (op == "div" || op == "mod") {
+		if (b == 0 || (a == INT_MIN && b == -1))
+			return 0;
+		result = op == "div" ? a / b : a % b;
+	} else if (op == "lt") result = a < b;
+	else if (op == "gt") result = a > b;
+	else if (op == "le") result = a <= b;
+	else if (op == "ge") result = a >= b;
+	else if (op == "eq") result = a == b;
+	else if (op == "ne") result = a != b;
+	else if (op == "and") result = a & b;
+	else if (op == "or") result = a | b;
+	else if (op == "xor") result = a ^ b;
+	else
+		return 0;
+	return 1;
+}
+
 unique_ptr<koopa::Value> AddBinExp(unique_ptr<koopa::BinaryExpr> bin_exp,
 vector<unique_ptr<koopa::Statement> > &stmts) {
+	auto val1 = bin_exp->val1.get(), val2 = bin_exp->val2.get();
+	int result;
+	if (val1->val_type == koopa::INTVALUE && val2->val_type == koopa::INTVALUE &&
+		FoldBinOp(bin_exp->op, static_cast<koopa::IntValue*>(val1)->integer,
+		static_cast<koopa::IntValue*>(val2)->integer, result))
+		return make_unique<koopa::IntValue>(result);
 	auto new_symb_def = make_unique<koopa::BinExprDef>(
 		"%" + to_string(temp_var_counter++), move(bin_exp));
 	stmts.push_back(move(new_symb_def));
@@ -74,6 +108,16 @@ vector<unique_ptr<koopa::Statement> > &stmts) {
 		return make_unique<koopa::IntValue>(const_symb->val);
 	}
 	auto var_symb = static_cast<const symtab::VarSymb*>(symb);
+	vector<unique_ptr<koopa::Value> > idx_vals;
+	vector<int> idx;
+	for (const auto &ptr: ast->dims) {
+		idx_vals.push_back(GetExp(ptr.get(), blocks, stmts));
+		if (idx_vals.back()->val_type == koopa::INTVALUE)
+			idx.push_back(static_cast<koopa::IntValue*>(idx_vals.back().get())->integer);
+	}
+	int const_val;
+	if (idx.size() == idx_vals.size() && var_symb->GetConst(idx, const_val))
+		return make_unique<koopa::IntValue>(const_val);
 	string ident = var_symb->name;
 	if (var_symb->is_param && !ast->dims.empty())
 	{	
@@ -83,9 +127,8 @@ vector<unique_ptr<koopa::Statement> > &stmts) {
 		stmts.push_back(move(load_def));
 	}
 	int is_p = var_symb->is_param;
-	for (const auto &ptr: ast->dims) {
+	for (auto &val: idx_vals) {
 		string new_ident = "%" + to_string(temp_var_counter++);
-		auto val = GetExp(ptr.get(), blocks, stmts);
 		if (is_p-- > 0) {
 			auto get_ptr = make_unique<koopa::GetPointer>(ident, move(val));
 			auto ptr_def = make_unique<koopa::GetPtrDef>(new_ident, move(get_ptr));
@@ -161,6 +204,16 @@ vector<unique_ptr<koopa::Statement> > &stmts) {
 }
 
 
+// Koopa instruction of a binary operator
+const char *OpInst(sysy::OpType op) {
+	static const char *insts[] = {
+		"",
+		"add", "sub", "mul", "div", "mod",
+		"lt", "gt", "le", "ge", "eq", "ne",
+		""};
+	return insts[op];
+}
+
 unique_ptr<koopa::Value> GetUnaryExp(const sysy::UnaryExp *ast,
 vector<unique_ptr<koopa::Block> > &blocks,
 vector<unique_ptr<koopa::Statement> > &stmts) {
@@ -168,19 +221,24 @@ vector<unique_ptr<koopa::Statement> > &stmts) {
 		auto new_ast = static_cast<const sysy::PrimUnaryExp*>(ast);
 		return GetPrimExp(new_ast->prim_exp.get(), blocks, stmts);
 	} else if (ast->exp_type == sysy::OPUNARYEXP) {
-		auto new_ast = static_cast<const sysy::OpUnaryExp*>(ast);
-		map<string, string> unary2inst({{"+", "add"}, {"-", "sub"}, {"!", "eq"}});
-		string inst = unary2inst[new_ast->op];
-		const auto &exp = new_ast->exp;
-		if (inst == "add")
-			return GetUnaryExp(exp.get(), blocks, stmts);
-		else {
-			auto ptr = GetUnaryExp(exp.get(), blocks, stmts);
+		// peel the whole prefix chain, then apply it from the inside out
+		vector<sysy::OpType> ops;
+		while (ast->exp_type == sysy::OPUNARYEXP) {
+			auto new_ast = static_cast<const sysy::OpUnaryExp*>(ast);
+			ops.push_back(new_ast->op);
+			ast = new_ast->exp.get();
+		}
+		auto ptr = GetUnaryExp(ast, blocks, stmts);
+		for (int i = ops.size() - 1; i >= 0; i--) {
+			if (ops[i] == sysy::OPADD)
+				continue;
+			string inst = ops[i] == sysy::OPNOT ? "eq" : OpInst(ops[i]);
 			auto new_zero_val = make_unique<koopa::IntValue>(0);
 			auto new_bin_exp = make_unique<koopa::BinaryExpr>(
 				inst, move(new_zero_val), move(ptr));
-			return AddBinExp(move(new_bin_exp), stmts);
+			ptr = AddBinExp(move(new_bin_exp), stmts);
 		}
+		return ptr;
 	} else if (ast->exp_type == sysy::FUNCUNARYEXP) {
 		auto new_ast = static_cast<const sysy::FuncUnaryExp*>(ast);
 		auto ptr = symtab_stack.GetSymbol(new_ast->ident);
@@ -207,139 +265,129 @@ vector<unique_ptr<koopa::Statement> > &stmts) {
 unique_ptr<koopa::Value> GetMulExp(const sysy::MulExp *ast,
 vector<unique_ptr<koopa::Block> > &blocks,
 vector<unique_ptr<koopa::Statement> > &stmts) {
-	if (ast->mul_exp) {
-		map<string, string> mul2inst({{"*", "mul"}, {"/", "div"}, {"%", "mod"}});
-		string inst = mul2inst[ast->op];
-		auto bin_exp = make_unique<koopa::BinaryExpr>(inst,
-			GetMulExp(ast->mul_exp.get(), blocks,
-			stmts), GetUnaryExp(ast->unary_exp.get(), blocks, stmts));
-		return AddBinExp(move(bin_exp), stmts);
-	} else
-		return GetUnaryExp(ast->unary_exp.get(), blocks, stmts);
-	return nullptr;
+	auto val = GetUnaryExp(ast->unary_exps[0].get(), blocks, stmts);
+	for (int i = 1; i < ast->unary_exps.size(); i++) {
+		auto bin_exp = make_unique<koopa::BinaryExpr>(OpInst(ast->ops[i - 1]),
+			move(val), GetUnaryExp(ast->unary_exps[i].get(), blocks, stmts));
+		val = AddBinExp(move(bin_exp), stmts);
+	}
+	return val;
 }
 
 unique_ptr<koopa::Value> GetAddExp(const sysy::AddExp *ast,
 vector<unique_ptr<koopa::Block> > &blocks,
 vector<unique_ptr<koopa::Statement> > &stmts) {
-	if (ast->add_exp) {
-		map<string, string> add2inst({{"+", "add"}, {"-", "sub"}});
-		string inst = add2inst[ast->op];
-		auto bin_exp = make_unique<koopa::BinaryExpr>(inst,
-			GetAddExp(ast->add_exp.get(), blocks, stmts),
-			GetMulExp(ast->mul_exp.get(), blocks, stmts));
-		return AddBinExp(move(bin_exp), stmts);
-	} else
-		return GetMulExp(ast->mul_exp.get(), blocks, stmts);
-	return nullptr;
+	auto val = GetMulExp(ast->mul_exps[0].get(), blocks, stmts);
+	for (int i = 1; i < ast->mul_exps.size(); i++) {
+		auto bin_exp = make_unique<koopa::BinaryExpr>(OpInst(ast->ops[i - 1]),
+			move(val), GetMulExp(ast->mul_exps[i].get(), blocks, stmts));
+		val = AddBinExp(move(bin_exp), stmts);
+	}
+	return val;
 }
 
 unique_ptr<koopa::Value> GetRelExp(const sysy::RelExp *ast,
 vector<unique_ptr<koopa::Block> > &blocks,
 vector<unique_ptr<koopa::Statement> > &stmts) {
-	if (ast->rel_exp) {
-		map<string, string> rel2inst({{"<", "lt"}, {">", "gt"}, {"<=", "le"}, {">=", "ge"}});
-		string inst = rel2inst[ast->op];
-		auto bin_exp = make_unique<koopa::BinaryExpr>(inst,
-			GetRelExp(ast->rel_exp.get(), blocks, stmts),
-			GetAddExp(ast->add_exp.get(), blocks, stmts));
-		return AddBinExp(move(bin_exp), stmts);
-	} else
-		return GetAddExp(ast->add_exp.get(), blocks, stmts);
-	return nullptr;
+	auto val = GetAddExp(ast->add_exps[0].get(), blocks, stmts);
+	for (int i = 1; i < ast->add_exps.size(); i++) {
+		auto bin_exp = make_unique<koopa::BinaryExpr>(OpInst(ast->ops[i - 1]),
+			move(val), GetAddExp(ast->add_exps[i].get(), blocks, stmts));
+		val = AddBinExp(move(bin_exp), stmts);
+	}
+	return val;
 }
 
 unique_ptr<koopa::Value> GetEqExp(const sysy::EqExp *ast,
 vector<unique_ptr<koopa::Block> > &blocks,
 vector<unique_ptr<koopa::Statement> > &stmts) {
-	if (ast->eq_exp) {
-		map<string, string> rel2inst({{"==", "eq"}, {"!=", "ne"}});
-		string inst = rel2inst[ast->op];
-		auto bin_exp = make_unique<koopa::BinaryExpr>(inst,
-			GetEqExp(ast->eq_exp.get(), blocks, stmts),
-			GetRelExp(ast->rel_exp.get(), blocks, stmts));
-		return AddBinExp(move(bin_exp), stmts);
-	} else
-		return GetRelExp(ast->rel_exp.get(), blocks, stmts);
-	return nullptr;
+	auto val = GetRelExp(ast->rel_exps[0].get(), blocks, stmts);
+	for (int i = 1; i < ast->rel_exps.size(); i++) {
+		auto bin_exp = make_unique<koopa::BinaryExpr>(OpInst(ast->ops[i - 1]),
+			move(val), GetRelExp(ast->rel_exps[i].get(), blocks, stmts));
+		val = AddBinExp(move(bin_exp), stmts);
+	}
+	return val;
 }
 
+// a chain a && b && c evaluates its operands in order into one result
+// variable, and every operand but the last branches to the shared false block
 unique_ptr<koopa::Value> GetLAndExp(const sysy::LAndExp *ast,
 vector<unique_ptr<koopa::Block> > &blocks,
 vector<unique_ptr<koopa::Statement> > &stmts) {
-	if (ast->land_exp) {
-		string then_symb = "%shortcircuit_and_true_" + to_string(block_counter++);
-		string else_symb = "%shortcircuit_and_false_" + to_string(block_counter++);
-		string end_symb = "%shortcircuit_and_end_" + to_string(block_counter++);
-		string ret_var = ("%" + to_string(temp_var_counter++));
-		AllocSymb(ret_var, make_shared<koopa::IntType>(), stmts);
-
-		auto l_exp = GetLAndExp(ast->land_exp.get(), blocks, stmts);
-		auto l_0 = make_unique<koopa::IntValue>(0);
-		auto l_logi = make_unique<koopa::BinaryExpr>("ne", move(l_0), move(l_exp));
-		auto l_val = AddBinExp(move(l_logi), stmts);
-		auto br = make_unique<koopa::Branch>(move(l_val), then_symb, else_symb);
-		blocks.push_back(MakeKoopaBlock(stmts, move(br)));
-
-		next_block_symbol = then_symb;
-		auto r_0 = make_unique<koopa::IntValue>(0);
-		auto r_exp = GetEqExp(ast->eq_exp.get(), blocks, stmts);
-		auto r_logi = make_unique<koopa::BinaryExpr>("ne", move(r_0), move(r_exp));
-		auto r_val = AddBinExp(move(r_logi), stmts);
-		StoreSymb(ret_var, move(r_val), stmts);
-		auto jmp = make_unique<koopa::Jump>(end_symb);
-		blocks.push_back(MakeKoopaBlock(stmts, move(jmp)));
-
-		next_block_symbol = else_symb;
+	int n = ast->eq_exps.size();
+	if (n == 1)
+		return GetEqExp(ast->eq_exps[0].get(), blocks, stmts);
+	string else_symb = "%shortcircuit_and_false_" + to_string(block_counter++);
+	string end_symb = "%shortcircuit_and_end_" + to_string(block_counter++);
+	string ret_var = ("%" + to_string(temp_var_counter++));
+	AllocSymb(ret_var, make_shared<koopa::IntType>(), stmts);
+
+	for (int i = 0; i < n; i++) {
+		auto exp = GetEqExp(ast->eq_exps[i].get(), blocks, stmts);
 		auto val_0 = make_unique<koopa::IntValue>(0);
-		StoreSymb(ret_var, move(val_0), stmts);
-		jmp = make_unique<koopa::Jump>(end_symb);
-		blocks.push_back(MakeKoopaBlock(stmts, move(jmp)));
+		auto logi = make_unique<koopa::BinaryExpr>("ne", move(val_0), move(exp));
+		auto val = AddBinExp(move(logi), stmts);
+		if (i + 1 < n) {
+			string then_symb = "%shortcircuit_and_true_" + to_string(block_counter++);
+			auto br = make_unique<koopa::Branch>(move(val), then_symb, else_symb);
+			blocks.push_back(MakeKoopaBlock(stmts, move(br)));
+			next_block_symbol = then_symb;
+		} else {
+			StoreSymb(ret_var, move(val), stmts);
+			auto jmp = make_unique<koopa::Jump>(end_symb);
+			blocks.push_back(MakeKoopaBlock(stmts, move(jmp)));
+		}
+	}
 
-		next_block_symbol = end_symb;
-		return LoadSymb(ret_var, stmts);
-	} else
-		return GetEqExp(ast->eq_exp.get(), blocks, stmts);
-	return nullptr;
+	next_block_symbol = else_symb;
+	auto val_0 = make_unique<koopa::IntValue>(0);
+	StoreSymb(ret_var, move(val_0), stmts);
+	auto jmp = make_unique<koopa::Jump>(end_symb);
+	blocks.push_back(MakeKoopaBlock(stmts, move(jmp)));
+
+	next_block_symbol = end_symb;
+	return LoadSymb(ret_var, stmts);
 }
 
+// same as GetLAndExp, with every operand but the last branching to the
+// shared true block
 unique_ptr<koopa::Value> GetLOrExp(const sysy::LOrExp *ast,
 vector<unique_ptr<koopa::Block> > &blocks,
 vector<unique_ptr<koopa::Statement> > &stmts) {
-	if (ast->lor_exp) {
-		string then_symb = "%shortcircuit_or_true_" + to_string(block_counter++);
-		string else_symb = "%shortcircuit_or_false_" + to_string(block_counter++);
-		string end_symb = "%shortcircuit_or_end_" + to_string(block_counter++);
-		string ret_var = ("%" + to_string(temp_var_counter++));
-		AllocSymb(ret_var, make_shared<koopa::IntType>(), stmts);
-
-		auto l_exp = GetLOrExp(ast->lor_exp.get(), blocks, stmts);
-		auto l_0 = make_unique<koopa::IntValue>(0);
-		auto l_logi = make_unique<koopa::BinaryExpr>("ne", move(l_0), move(l_exp));
-		auto l_val = AddBinExp(move(l_logi), stmts);
-		auto br = make_unique<koopa::Branch>(move(l_val), then_symb, else_symb);
-		blocks.push_back(MakeKoopaBlock(stmts, move(br)));
-
-		next_block_symbol = then_symb;
-		auto val_1 = make_unique<koopa::IntValue>(1);
-		StoreSymb(ret_var, move(val_1), stmts);
-		auto jmp = make_unique<koopa::Jump>(end_symb);
-		blocks.push_back(MakeKoopaBlock(stmts, move(jmp)));
+	int n = ast->land_exps.size();
+	if (n == 1)
+		return GetLAndExp(ast->land_exps[0].get(), blocks, stmts);
+	string then_symb = "%shortcircuit_or_true_" + to_string(block_counter++);
+	string end_symb = "%shortcircuit_or_end_" + to_string(block_counter++);
+	string ret_var = ("%" + to_string(temp_var_counter++));
+	AllocSymb(ret_var, make_shared<koopa::IntType>(), stmts);
+
+	for (int i = 0; i < n; i++) {
+		auto exp = GetLAndExp(ast->land_exps[i].get(), blocks, stmts);
+		auto val_0 = make_unique<koopa::IntValue>(0);
+		auto logi = make_unique<koopa::BinaryExpr>("ne", move(val_0), move(exp));
+		auto val = AddBinExp(move(logi), stmts);
+		if (i + 1 < n) {
+			string else_symb = "%shortcircuit_or_false_" + to_string(block_counter++);
+			auto br = make_unique<koopa::Branch>(move(val), then_symb, else_symb);
+			blocks.push_back(MakeKoopaBlock(stmts, move(br)));
+			next_block_symbol = else_symb;
+		} else {
+			StoreSymb(ret_var, move(val), stmts);
+			auto jmp = make_unique<koopa::Jump>(end_symb);
+			blocks.push_back(MakeKoopaBlock(stmts, move(jmp)));
+		}
+	}
 
-		next_block_symbol = else_symb;
-		auto r_0 = make_unique<koopa::IntValue>(0);
-		auto r_exp = GetLAndExp(ast->land_exp.get(), blocks, stmts);
-		auto r_logi = make_unique<koopa::BinaryExpr>("ne", move(r_0), move(r_exp));
-		auto r_val = AddBinExp(move(r_logi), stmts);
-		StoreSymb(ret_var, move(r_val), stmts);
-		jmp = make_unique<koopa::Jump>(end_symb);
-		blocks.push_back(MakeKoopaBlock(stmts, move(jmp)));
+	next_block_symbol = then_symb;
+	auto val_1 = make_unique<koopa::IntValue>(1);
+	StoreSymb(ret_var, move(val_1), stmts);
+	auto jmp = make_unique<koopa::Jump>(end_symb);
+	blocks.push_back(MakeKoopaBlock(stmts, move(jmp)));
 
-		next_block_symbol = end_symb;
-		return LoadSymb(ret_var, stmts);
-	} else
-		return GetLAndExp(ast->land_exp.get(), blocks, stmts);
-	return nullptr;
+	next_block_symbol = end_symb;
+	return LoadSymb(ret_var, stmts);
 }
 
 unique_ptr<koopa::Value> GetExp(const sysy::Exp *ast,
@@ -347,6 +395,8 @@ vector<unique_ptr<koopa::Block> > &blocks,
 vector<unique_ptr<koopa::Statement> > &stmts) {
 	if (!ast)
 		return nullptr;
+	if (ast->is_literal)
+		return make_unique<koopa::IntValue>(ast->literal);
 	return GetLOrExp(ast->exp.get(), blocks, stmts);
 }
 
@@ -473,104 +523,114 @@ vector<unique_ptr<koopa::Statement> > &stmts) {
 	}
 }
 
-void GetConstInitVal(const sysy::InitVal *init_val,
-vector<int> suf_mul, vector<int> &result) {
-	auto list_val = static_cast<const sysy::ListInitVal*>(init_val);
-	int cur_pos = 0;
-	vector<unique_ptr<koopa::Initializer> > v;
-	for (const auto &ptr: list_val->inits) {
+// flattens a braced initializer into one Exp per element, nullptr for the
+// elements left to 0; nested braces are walked with an explicit stack
+void FlattenInitVal(const sysy::InitVal *init_val, const vector<int> &suf_mul,
+vector<const sysy::Exp*> &result) {
+	struct Frame {
+		const sysy::ListInitVal *list;
+		int next, level, begin;
+	};
+	vector<Frame> frames;
+	frames.push_back({static_cast<const sysy::ListInitVal*>(init_val), 0, 0, (int)result.size()});
+	while (!frames.empty()) {
+		auto &frame = frames.back();
+		if (frame.next == frame.list->inits.size()) {
+			result.resize(frame.begin + suf_mul[frame.level], nullptr);
+			frames.pop_back();
+			continue;
+		}
+		auto ptr = frame.list->inits[frame.next++].get();
 		if (ptr->init_type == sysy::EXPINITVAL) {
-			auto exp_ptr = static_cast<const sysy::ExpInitVal*>(ptr.get());
-			result.push_back(exp_ptr->exp->Eval());
-			cur_pos++;
-		} else {
-			for (int i = 1; i + 1 < suf_mul.size(); i++) {
-				if (cur_pos % suf_mul[i] == 0) {
-					vector<int> new_suf(suf_mul.begin() + i, suf_mul.end());
-					GetConstInitVal(ptr.get(), new_suf, result);
-					cur_pos += suf_mul[i];
-					break;
-				}
-			}
+			result.push_back(static_cast<const sysy::ExpInitVal*>(ptr)->exp.get());
+			continue;
 		}
+		int cur_pos = result.size() - frame.begin;
+		for (int i = frame.level + 1; i + 1 < suf_mul.size(); i++)
+			if (cur_pos % suf_mul[i] == 0) {
+				frames.push_back({static_cast<const sysy::ListInitVal*>(ptr), 0, i, (int)result.size()});
+				break;
+			}
 	}
-	for(; cur_pos < suf_mul[0]; cur_pos++)
-		result.push_back(0);
+}
+
+void GetConstInitVal(const sysy::InitVal *init_val,
+const vector<int> &suf_mul, vector<int> &result) {
+	vector<const sysy::Exp*> exps;
+	FlattenInitVal(init_val, suf_mul, exps);
+	for (auto exp: exps)
+		result.push_back(exp ? exp->Eval() : 0);
 }
 
 void GetInitVal(const sysy::InitVal *init_val,
-vector<int> suf_mul, vector<unique_ptr<koopa::Value> > &result,
+const vector<int> &suf_mul, vector<unique_ptr<koopa::Value> > &result,
 vector<unique_ptr<koopa::Block> > &blocks,
 vector<unique_ptr<koopa::Statement> > &stmts) {
-	auto list_val = static_cast<const sysy::ListInitVal*>(init_val);
-	int cur_pos = 0;
-	vector<unique_ptr<koopa::Initializer> > v;
-	for (const auto &ptr: list_val->inits) {
-		if (ptr->init_type == sysy::EXPINITVAL) {
-			auto exp_ptr = static_cast<const sysy::ExpInitVal*>(ptr.get());
-			result.push_back(GetExp(exp_ptr->exp.get(), blocks, stmts));
-			cur_pos++;
-		} else {
-			for (int i = 1; i + 1 < suf_mul.size(); i++) {
-				if (cur_pos % suf_mul[i] == 0) {
-					vector<int> new_suf(suf_mul.begin() + i, suf_mul.end());
-					GetInitVal(ptr.get(), new_suf, result, blocks, stmts);
-					cur_pos += suf_mul[i];
-					break;
-				}
-			}
-		}
+	vector<const sysy::Exp*> exps;
+	FlattenInitVal(init_val, suf_mul, exps);
+	for (auto exp: exps) {
+		if (exp)
+			result.push_back(GetExp(exp, blocks, stmts));
+		else
+			result.push_back(make_unique<koopa::IntValue>(0));
 	}
-	for(; cur_pos < suf_mul[0]; cur_pos++)
-		result.push_back(make_unique<koopa::IntValue>(0));
 }
 
+// the aggregate for suf_mul[level] elements of lin_init starting at pos
 std::unique_ptr<koopa::Initializer> MakeKoopaInit(
-vector<int> lin_init, vector<int> suf_mul) {
-	if(suf_mul.size() == 1)
-		return make_unique<koopa::IntInit>(lin_init[0]);
-	int n1 = suf_mul[0] / suf_mul[1];
-	vector<int> new_suf(suf_mul.begin() + 1, suf_mul.end());
+const vector<int> &lin_init, int pos, const vector<int> &suf_mul, int level) {
+	if(level + 1 == suf_mul.size())
+		return make_unique<koopa::IntInit>(lin_init[pos]);
+	int n1 = suf_mul[level] / suf_mul[level + 1];
 	vector<unique_ptr<koopa::Initializer> > inits;
-	for(int i = 0; i < n1; i++) {
-		vector<int> new_lin(lin_init.begin() + i * suf_mul[1],
-			lin_init.begin() + (i + 1) * suf_mul[1]);
-		inits.push_back(MakeKoopaInit(new_lin, new_suf));
-	}
+	for(int i = 0; i < n1; i++)
+		inits.push_back(MakeKoopaInit(lin_init, pos + i * suf_mul[level + 1], suf_mul, level + 1));
 	return make_unique<koopa::AggregateInit>(move(inits));
 }
 
 std::unique_ptr<koopa::Initializer> KoopaInitWith0(
-vector<int> lin_init, vector<int> suf_mul) {
+const vector<int> &lin_init, const vector<int> &suf_mul) {
 	int all_zero = 0;
 	for (int x: lin_init)
 		all_zero |= x;
 	if (!all_zero)
 		return make_unique<koopa::ZeroInit>();
 	else
-		return MakeKoopaInit(lin_init, suf_mul);
+		return MakeKoopaInit(lin_init, 0, suf_mul, 0);
 }
 
+int IsZeroValue(const koopa::Value *val) {
+	return val->val_type == koopa::INTVALUE &&
+		static_cast<const koopa::IntValue*>(val)->integer == 0;
+}
+
+// zero fill the whole array first when most elements are 0, then store the
+// remaining elements through getptr offsets from the first element
 void GenArrayStore(vector<unique_ptr<koopa::Value> > lin_init, vector<int> suf_mul,
 string cur_symb, vector<unique_ptr<koopa::Statement> > &stmts) {
-	if (suf_mul.size() == 1) {
-		auto store = make_unique<koopa::ValueStore>(move(lin_init[0]), cur_symb);
-		stmts.push_back(move(store));
-	} else {
-		int n1 = suf_mul[0] / suf_mul[1];
-		vector<int> new_suf = vector<int>(suf_mul.begin() + 1, suf_mul.end());
-		for (int i = 0; i < n1; i++) {
-			string new_symb = "%" + to_string(temp_var_counter++);
-			auto i_val = make_unique<koopa::IntValue>(i);
-			auto get_elem = make_unique<koopa::GetElementPointer>(cur_symb, move(i_val));
-			auto symb_def = make_unique<koopa::GetElemPtrDef>(new_symb, move(get_elem));
-			stmts.push_back(move(symb_def));
-			vector<unique_ptr<koopa::Value> > new_lin;
-			for(auto it = lin_init.begin() + i * suf_mul[1]; 
-			it != lin_init.begin() + (i + 1) * suf_mul[1]; it++)
-				new_lin.push_back(move(*it));
-			GenArrayStore(move(new_lin), new_suf, new_symb, stmts);
+	int zeros = 0;
+	for (const auto &val: lin_init)
+		zeros += IsZeroValue(val.get());
+	int zero_fill = zeros * 2 > (int)lin_init.size();
+	if (zero_fill)
+		stmts.push_back(make_unique<koopa::InitStore>(make_unique<koopa::ZeroInit>(), cur_symb));
+	string base = cur_symb;
+	for (int i = 1; i < suf_mul.size(); i++) {
+		string new_symb = "%" + to_string(temp_var_counter++);
+		auto get_elem = make_unique<koopa::GetElementPointer>(base, make_unique<koopa::IntValue>(0));
+		stmts.push_back(make_unique<koopa::GetElemPtrDef>(new_symb, move(get_elem)));
+		base = new_symb;
+	}
+	for (int i = 0; i < lin_init.size(); i++) {
+		if (zero_fill && IsZeroValue(lin_init[i].get()))
+			continue;
+		string elem = base;
+		if (i > 0) {
+			elem = "%" + to_string(temp_var_counter++);
+			auto get_ptr = make_unique<koopa::GetPointer>(base, make_unique<koopa::IntValue>(i));
+			stmts.push_back(make_unique<koopa::GetPtrDef>(elem, move(get_ptr)));
 		}
+		stmts.push_back(make_unique<koopa::ValueStore>(move(lin_init[i]), elem));
 	}
 }
 
@@ -581,9 +641,8 @@ shared_ptr<koopa::Type> Dims2Type(vector<int> num_dims) {
 	return type;
 }
 
-void GetConstDef(const sysy::ConstDef *ast,
-vector<unique_ptr<koopa::Block> > &blocks,
-vector<unique_ptr<koopa::Statement> > &stmts) {
+void GetGlobalConstDef(const sysy::ConstDef *ast,
+vector<unique_ptr<koopa::GlobalSymbolDef> > &global_symbs) {
 	if (ast->dims.empty()) {
 		const auto &init = ast->init_val;
 		assert(init->init_type == sysy::EXPINITVAL);
@@ -592,26 +651,41 @@ vector<unique_ptr<koopa::Statement> > &stmts) {
 		auto new_symb = make_unique<symtab::ConstSymb>(val);
 		symtab_stack.AddSymbol(ast->ident, move(new_symb));
 	} else {
-		string name = "@" + ast->ident + "_" + to_string(symtab_stack.GetTotal());
 		vector<int> num_dims;
 		for (const auto &exp: ast->dims)
 			num_dims.push_back(exp->Eval());
-		AllocSymb(name, Dims2Type(num_dims), stmts);
 		vector<int> suf_mul(num_dims);
 		for(auto it = suf_mul.rbegin() + 1; it != suf_mul.rend(); it++)
 			*it *= *(it-1);
 		suf_mul.push_back(1);
 		vector<int> lin_init;
-		GetConstInitVal(ast->init_val.get(), suf_mul, lin_init);
-		vector<unique_ptr<koopa::Value> > new_lin;
-		for (int x: lin_init)
-			new_lin.push_back(make_unique<koopa::IntValue>(x));
-		GenArrayStore(move(new_lin), suf_mul, name, stmts);
-		auto new_symb = make_unique<symtab::VarSymb>(name, 0, num_dims.size());
-		symtab_stack.AddSymbol(ast->ident, move(new_symb));
+		if(ast->init_val)
+			GetConstInitVal(ast->init_val.get(), suf_mul, lin_init);
+		else
+			lin_init = vector<int>(suf_mul[0], 0);
+		auto init = KoopaInitWith0(lin_init, suf_mul);
+		auto mem_dec = make_unique<koopa::GlobalMemDec>(Dims2Type(num_dims), move(init));
+		string name = "@" + ast->ident + "_" + to_string(symtab_stack.GetTotal());
+		symtab_stack.AddSymbol(ast->ident,
+			make_unique<symtab::VarSymb>(name, 0, num_dims.size(), suf_mul, lin_init));
+		global_symbs.push_back(make_unique<koopa::GlobalSymbolDef>(name, move(mem_dec), 1));
 	}
 }
 
+void GetConstDef(const sysy::ConstDef *ast,
+vector<unique_ptr<koopa::Block> > &blocks,
+vector<unique_ptr<koopa::Statement> > &stmts) {
+	if (ast->dims.empty()) {
+		const auto &init = ast->init_val;
+		assert(init->init_type == sysy::EXPINITVAL);
+		auto exp_init = static_cast<const sysy::ExpInitVal*>(init.get());
+		int val = exp_init->exp->Eval();
+		auto new_symb = make_unique<symtab::ConstSymb>(val);
+		symtab_stack.AddSymbol(ast->ident, move(new_symb));
+	} else
+		GetGlobalConstDef(ast, hoisted_symbs);
+}
+
 void GetVarDef(const sysy::VarDef *ast,
 vector<unique_ptr<koopa::Block> > &blocks,
 vector<unique_ptr<koopa::Statement> > &stmts) {
@@ -729,36 +803,6 @@ unique_ptr<koopa::FunDef> GetFuncDef(const sysy::FuncDef *ast) {
 	return make_unique<koopa::FunDef>(symbol, move(koopa_params), move(ret_type), move(fun_body));
 }
 
-void GetGlobalConstDef(const sysy::ConstDef *ast,
-vector<unique_ptr<koopa::GlobalSymbolDef> > &global_symbs) {
-	if (ast->dims.empty()) {
-		const auto &init = ast->init_val;
-		assert(init->init_type == sysy::EXPINITVAL);
-		auto exp_init = static_cast<const sysy::ExpInitVal*>(init.get());
-		int val = exp_init->exp->Eval();
-		auto new_symb = make_unique<symtab::ConstSymb>(val);
-		symtab_stack.AddSymbol(ast->ident, move(new_symb));
-	} else {
-		vector<int> num_dims;
-		for (const auto &exp: ast->dims)
-			num_dims.push_back(exp->Eval());
-		vector<int> suf_mul(num_dims);
-		for(auto it = suf_mul.rbegin() + 1; it != suf_mul.rend(); it++)
-			*it *= *(it-1);
-		suf_mul.push_back(1);
-		vector<int> lin_init;
-		if(ast->init_val)
-			GetConstInitVal(ast->init_val.get(), suf_mul, lin_init);
-		else
-			lin_init = vector<int>(suf_mul[0], 0);
-		auto init = KoopaInitWith0(lin_init, suf_mul);
-		auto mem_dec = make_unique<koopa::GlobalMemDec>(Dims2Type(num_dims), move(init));
-		string name = "@" + ast->ident + "_" + to_string(symtab_stack.GetTotal());
-		symtab_stack.AddSymbol(ast->ident, make_unique<symtab::VarSymb>(name, 0, num_dims.size()));
-		global_symbs.push_back(make_unique<koopa::GlobalSymbolDef>(name, move(mem_dec)));
-	}
-}
-
 void GetGlobalVarDef(const sysy::VarDef *ast,
 vector<unique_ptr<koopa::GlobalSymbolDef> > &global_symbs) {
 	if (ast->dims.empty()) {
@@ -820,12 +864,22 @@ vector<unique_ptr<koopa::GlobalSymbolDef> > &global_symbs) {
 }
 
 unique_ptr<koopa::Program> GetCompUnit(const sysy::CompUnit *ast) {
+	temp_var_counter = 0;
+	block_counter = 0;
+	next_block_symbol.clear();
+	while_begin_stack.clear();
+	while_end_stack.clear();
+	hoisted_symbs.clear();
+	symtab_stack.Reset();
 	vector<unique_ptr<koopa::FunDef> > funs;
 	vector<unique_ptr<koopa::GlobalSymbolDef> > global_symbs;
 	for (const auto &ptr: ast->items) {
 		if (ptr->item_type == sysy::FUNCDEFITEM) {
 			auto new_ptr = static_cast<const sysy::FuncDefItem*>(ptr.get());
 			funs.push_back(GetFuncDef(new_ptr->func_def.get()));
+			for (auto &symb: hoisted_symbs)
+				global_symbs.push_back(move(symb));
+			hoisted_symbs.clear();
 		} else {
 			auto new_ptr = static_cast<const sysy::DeclItem*>(ptr.get());
 			GetGlobalSymb(new_ptr->decl.get(), global_symbs);